@@ -12,7 +12,7 @@
  * Must be linked with support routines defined in "trn.h"
  * and "trn.c"; i.e., compile with a command such as
  *
- *   gcc cglp4.c trn.c [conio3.c] -lm -lgmp -D__NOMPFR__
+ *   gcc cglp4.c trn.c [conio3.c] -lm -lgmp -lpthread -D__NOMPFR__
  *
  * with cglp4.c, trn.c, and trn.h in the search path. See
  * "trn.c" for the source code of routines such as iPrP,
@@ -24,7 +24,7 @@
  *
  * SYNTAX:
  *
- * cglp4 infile [x|m|M|z|b] [mingap maxgap] [mindig maxdig] [n]
+ * cglp4 infile [x|m|M|z|e|b] [mingap maxgap] [mindig maxdig] [n]
  *
  * where infile is the input data file; only gaps within
  * mingap <= gap <= maxgap and mindig <= digits <= maxdig are checked.
@@ -35,7 +35,9 @@
  * specified, _all_ endpoints will be checked with the full BPSW test.
  * If the z parameter is given, no checking is done; instead a file
  * nocheck.dat is created, containing * the gaps (in standard format)
- * which _would have been_ checked. The optional final parameter n
+ * which _would have been_ checked; the e parameter does the same, but
+ * writes the binary gap list nocheck.gpb instead (see NOTE (12)).
+ * The optional final parameter n
  * will suppress reporting of intermediate results to the screen.
  *
  * If maxgap=0 is specified, ulMaxGap=ulMinGap will be assumed.
@@ -50,6 +52,7 @@
  * see <http://sourceforge.net/projects/openpfgw/files/>. Use of
  * PFGW may be disabled by temporarily renaming its executable files
  * and/or directory, or by setting the environment variable NOPFGW.
+ * Other provers may be chosen by the size of the gap (see NOTE (20)).
  *
  * INPUT: Each line of the ASCII text input file is presumed to
  * have the following format.
@@ -141,6 +144,148 @@
  *
  * (9) Must be linked with GMP, but MPFR is not used.
  *
+ * (10) If the environmental variable CGLP4_THREADS is set to a number
+ * n > 1, the rounds of iPrP (base-2 Miller and strong Lucas-Selfridge
+ * together, then the MRREPS extra rounds together) are run on a pool
+ * of n threads for endpoints of 2048 bits or more; the first round
+ * proving composite cancels the others. CGLP4_THREADS=0 uses all the
+ * online processors. In the endpoints-only modes (x and m), the
+ * endpoints of up to 4n gaps are instead queued and tested together,
+ * P1 and P2 concurrently, with the results still reported in input
+ * order. Requires POSIX threads (link with -lpthread); the results
+ * are the same as in the serial code.
+ *
+ * (11) Before their Fermat tests, the sieve survivors in the interior
+ * of a gap may be given a stage 1 Pollard P-1 test (bound B1 <= 65521),
+ * which finds some of the prime divisors beyond the sieve limit much
+ * more cheaply than the Fermat test of a very large candidate. It is
+ * used only when a cost model (ulPMinus1B1 in trn.c) expects it to
+ * save time, which with the default sieve limits means P1 of roughly
+ * 200K digits or more. The environmental variable CGLP4_PM1 may be
+ * set to 0 to disable it, or to B1 > 0 to force it with that bound.
+ * The number of candidates eliminated is reported with the totals.
+ *
+ * (12) The e parameter exports the selected gaps to nocheck.gpb, a
+ * binary gap list holding the text of each record along with its P1,
+ * already evaluated (in GMP's mpz_out_raw format), and an index of the
+ * records by gap and by digits (see struct __gapbinhdr in trn.h). Such
+ * a list may be given as infile in any mode; no formula is parsed or
+ * decimal P1 converted again, and only the records within the gap and
+ * digit ranges given are read, by way of the index. It is a faster
+ * form of a master list which is to be verified repeatedly; it is
+ * written in the byte order of the machine and is not portable to one
+ * of the other order.
+ *
+ * (13) If a gap or digit range is given, only the records within it
+ * are read, in input order, by way of an index of the list by gap and
+ * by digits: that of a binary gap list, or else the sidecar index
+ * infile.gix of a text list. The sidecar is built (with one full
+ * reading of the list, evaluating the P1 of any type 1 records) the
+ * first time it is needed, and again whenever the size, time, or inode
+ * of the list change; if it cannot be written, it is built for each
+ * run. It is written under a temporary name and renamed into place.
+ * The list need not be sorted. Setting the environmental variable
+ * CGLP4_INDEX to 0 disables the sidecar, and the text list is then
+ * read in full.
+ *
+ * (14) Where POSIX threads are supported, the input is read, parsed,
+ * and evaluated (including formulas for P1, and the counting of its
+ * digits) on a thread of its own, up to 8 records ahead of the tests,
+ * so that the evaluation of a large primorial or the assembly of a
+ * long continued record overlaps the sieving and testing of the gap
+ * before it. The results are unchanged. Setting the environmental
+ * variable CGLP4_READER to 0 reads each record only when it is to be
+ * tested, as before.
+ *
+ * (15) The output file cglp4.out is kept open, and the results are
+ * buffered, rather than the file being opened and closed for each
+ * result. By default the buffer is written out once a second (when a
+ * result is recorded), as well as at the end of the run, at the
+ * "power outage" flushes of large gaps, and on SIGINT, SIGTERM, or
+ * SIGHUP. The environmental variable CGLP4_FLUSH may be set to a
+ * number of results N (write out every N results), to a number of
+ * seconds followed by s (e.g. 10s), or to 0 (write out only when the
+ * buffer is full, and on the occasions above). The text of cglp4.out
+ * is unchanged.
+ *
+ * (16) The "power outage" flushes, and the writing of the backup files
+ * g*.bak and g*.siv, formerly called sync(), committing every file on
+ * the system to the disk and waiting for it. Now only the file itself
+ * (cglp4.out, or the backup file) is committed, by fdatasync, and by
+ * default on a thread of its own, so that the tests need not wait on
+ * the disk. The environmental variable CGLP4_DURABLE may be set to
+ * strict (wait for the disk), async (the default), or none (leave the
+ * files to the operating system).
+ *
+ * (17) If the environmental variable CGLP4_RESULTS names a file, the
+ * results are also appended to it in a form for programs to read: a
+ * CSV table (with a header line, if the file is new) if the name ends
+ * in .csv, otherwise one JSON object per line (JSONL). Each result
+ * gives the gap, the stated digits, P1 in full as written, the
+ * verdict (OK or ERROR) with the detail of an error (the divisor or
+ * failed test, Gtrue, and the offset of an intermediate prime), the
+ * tests used (as in cglp4.out), and the wall and processor seconds of
+ * each phase: reading and evaluating the record (parse), testing P1,
+ * sieving, testing the interior, and testing P2. The parse times are
+ * those of the reader thread alone; the others are of the process,
+ * and so include the thread pool. The endpoints of the gaps of the x
+ * and m modes are tested together, and the time of each batch is
+ * shared equally among its endpoints. The file is buffered as
+ * cglp4.out is (see NOTE (15)).
+ *
+ * (18) The running status line ("...Checking P1...") is written to
+ * stderr by vProgress (trn.c), with ANSI sequences under Linux and
+ * Cygwin, at most four times a second, and not at all if stderr is
+ * not a terminal; the result lines are still written. Formerly each
+ * update first blanked the line, and under pfgw cleared the screen
+ * by running clear, a process for every update.
+ *
+ * (19) PFGW is no longer run once for each interior candidate (with
+ * the candidate written to a file of its own, and only the exit code
+ * read). Instead the sieve survivors of a gap are written in chunks
+ * to one ABC file N<gap>.dat (the header "ABC <P1>+$a", then one
+ * offset to a line), PFGW is run once for each chunk, with its output
+ * in N<gap>.out, and the first offset reported PRP (a line ending in
+ * "+<offset> is ...PRP..." or "...prime...", not "composite") is
+ * confirmed with BPSW. PFGW is no longer given -Cquiet, since every
+ * offset must be reported, composite or not, and PFGW must exit with
+ * status 0; otherwise the run is taken to have failed, and the chunk
+ * is tested with GMP. The first chunk holds 64 survivors, each later
+ * one twice as many, up to 4096, or to the value of the environmental
+ * variable CGLP4_PFGW_CHUNK. P2 is tested with GMP, as before; the
+ * backup file is written between chunks, every CGLP4BUI seconds. The
+ * environmental variable CGLP4_PFGW may be set to the command to be
+ * run in place of PFGW (the file name being appended), e.g. a script
+ * which reads the ABC file and writes such lines, on any platform;
+ * PFGW itself is looked for in the current directory and in c:\pfgw
+ * under Windows, and on the PATH (as pfgw64 or pfgw) elsewhere
+ * (NOTE (20)). If the command cannot be run, or fails, the gaps
+ * are tested with GMP alone.
+ *
+ * (20) The interior of a gap may be tested by any of several provers,
+ * chosen by the number of digits of P1. The environmental variable
+ * CGLP4_PROVERS is a list of entries <digits>:<prover>, separated by
+ * semicolons, e.g. "0:gmp;1000:batch=pfgw64 -k -f0;5000:coproc=
+ * myprover"; each gap is tested by the prover of the entry with the
+ * greatest number of digits not exceeding its own. The provers are
+ * gmp (the tests of this code, the default), mock (GMP's own
+ * mpz_probab_prime_p, in place of an external prover, for testing),
+ * batch=<command> (the command is run once for each chunk of NOTE
+ * (19), on an ABC file, %i and %o standing for the input and output
+ * files; without %i, the input file is appended, and without %o, its
+ * standard output is read), and
+ * coproc=<command> (GNU/Linux and Cygwin; the command is started once
+ * and sent "B <P1>" for each gap, then "T <offset>" for each candidate
+ * and "F" after each 64 candidates (or fewer, at the end of a chunk),
+ * to which it replies with one line "<offset> P" (probable prime) or
+ * "<offset> C" (composite) for each T, in order, before more are sent;
+ * "Q" ends it). A batch command must report every offset and exit
+ * with status 0 (NOTE (19)). The candidates reported prime by batch,
+ * coproc, or mock are confirmed with BPSW; if an external prover
+ * fails, it is dropped with a warning, and its gaps are tested with
+ * GMP. Without CGLP4_PROVERS, PFGW is used as before (NOTE (19)) if
+ * found, now also on the PATH (as pfgw64 or pfgw) outside Windows.
+ *
  */
 
 #if !defined(_TRN_H_)
@@ -154,21 +299,46 @@
 #define DEFAULT_BASES 1  /* Number of Miller-Rabin tests in BPSW */
 #define OUTFILE "cglp4.out"
 #define NOCHECKFILE "nocheck.dat"
+#define NOCHECKBIN "nocheck.gpb"
 #define BACKUP_INTERVAL 60
 #define MIN_PFGW_DIGITS 1000
+#define PROVERS_MAX 16  /* Entries of CGLP4_PROVERS */
 #define MIN_MR2_DIGITS 1000000UL  /* This feature thus currently disabled */
+#define GAPQ_SLOTS 8  /* Records read and evaluated ahead of the tests */
+
+struct gapq_slot;
 
 static unsigned long    mpz_gap(void);
-static unsigned long    mpz_gap_pfgw(void);
+static unsigned long    mpz_gap_ext(struct __prover *ppr);
+static void             vProvers(char *szConfig);
+static struct __prover  *pProverFor(unsigned long ulDigits);
+static int              iOnPath(char *szName, char *szPath);
 static void             vSieve2(void);
+static void             vPMinus1Task(void *pv, long l);
+static long             lPMinus1Filter(long nGB);
 static void             vSyntax(void);
+static void             vEPOQueue(char *szP1, char *szP1tt, char *szP1t2,
+			  char *szP1t);
+static void             vEPOFlush(unsigned long *pulOK,
+			  unsigned long *pulErrors);
+static int              iGapQRead(struct gapq_slot *pgs);
+static void             vGapQStart(int iThread);
+static struct gapq_slot *pGapQNext(void);
+static void             vGapQStop(void);
+static void             vPhaseStart(double *plfParse);
+static void             vPhaseMark(int iPhase);
+static void             vResult(unsigned long ulG, unsigned long ulD,
+			  char *szP1, int iMR2, const char *szMode,
+			  const char *szDetail, unsigned long ulDivisor,
+			  const char *szWitness, long lGtrue,
+			  unsigned long ulOffset);
 
 /* Static declarations keeps functions private, prevents linker clashes. */
 
 extern           unsigned long ulPrime16[];  /* 16-bit primes; see trn.c */
 
 char      sz[256], sz2[256], sz3[256], ch, szSieveFile[256],
-		 szDivFile[256], szBackupFile[256], *szBuffer, szPFGW[128];
+		 szDivFile[256], szBackupFile[256], *szBuffer, szPFGW[512];
 uint8_t   *uchSieve;
 int       iMR2Base=0, iBackup=0, iSpecial=0, iSW=79,
 		 iCheckSieve=0, ix, iy, iInsideGap=0, iBackupAll=0,
@@ -177,12 +347,104 @@ int       iMR2Base=0, iBackup=0, iSpecial=0, iSW=79,
 unsigned long    ulD1;
 unsigned long
 		 ulGap, ulMD, ulMG, ulP1Rem, ulGBack=2,
-		 ulMRReps=DEFAULT_BASES, *ulLPD;
+		 ulMRReps=DEFAULT_BASES, *ulLPD, ulPFGWChunk=4096;
 double    lft0, lfLastBackupTime, lfBUI=BACKUP_INTERVAL, lfTstart,
 		 dt;
-FILE      *fpIn, *fpOut, *fpBackup, *fpSieve, *fp, *fpDiv, *fpNoCheck;
+struct __gaplist *pglIn;
+struct __gaprec  grIn;
+struct __gapbinout *pgboNoCheck=NULL;  /* for the e parameter */
+FILE      *fpBackup, *fpSieve, *fp, *fpDiv, *fpNoCheck;
+struct __logsink *plsOut;  /* OUTFILE */
+struct __logsink *plsRes=NULL;  /* CGLP4_RESULTS, if set */
+int       iResCSV=0;
+struct __prover  *pprTab[PROVERS_MAX];  /* CGLP4_PROVERS (NOTE (20)) */
+unsigned long    ulProverMin[PROVERS_MAX];
+int       nProvers=0;
 mpz_t		 mpzP1, mpzP2, mpz, mpzRem, mpzTwo, mpzD, mpzR;
 
+/* Queue of gaps awaiting the testing of their endpoints (x and m
+   modes). The endpoints of all the queued gaps are tested together by
+   iPrPBatch, on the thread pool if there is one, and the results are
+   then reported in input order. P1 and P2 of queued gap l are
+   pmpzEPO[2*l] and pmpzEPO[2*l + 1], with results in piEPO. */
+
+struct epo_rec
+  {
+  unsigned long   ulGap, ulD1;
+  int             iMR2;
+  char            szP1tt[64], szP1t2[64], szP1t[64];
+  char            *szP1;         /* in full, for plsRes only */
+  double          lfParse[2];    /* for plsRes (see lfPhase) */
+  };
+struct epo_rec  *pEPO;
+mpz_t           *pmpzEPO;
+int             *piEPO;
+long            nEPO=0, nEPOMax=1;
+
+/* Queue of records read ahead of the tests. The reader (a thread of
+   its own, if there is one; see vGapQStart) reads, parses, and filters
+   the records, evaluates P1, counts its digits, and makes the ellipsed
+   forms of P1 for reporting, into gqSlot; the main loop takes them in
+   input order from pGapQNext. A slot remains filled (lGQFull) until
+   the main loop has finished with it. */
+
+struct gapq_slot
+  {
+  char            *szRec;        /* copy of the record */
+  size_t          ulRecMax;      /* space at szRec */
+  char            *szP1;         /* P1, within szRec */
+  int             iType;         /* as returned by iGetGapRecObj */
+  int             iP1Bad;        /* P1 could not be parsed */
+  unsigned long   ulGap, ulD1, ulD1a;  /* ulD1a counted, if P1 >= 2 */
+  char            szP1tt[64], szP1t2[64], szP1t[64];
+  double          lfParse[2];    /* wall, processor seconds to read */
+  mpz_t           mpzP1;
+  };
+struct gapq_slot gqSlot[GAPQ_SLOTS];
+long            lGQHead=0, lGQFull=0;
+int             iGQEOF=0, iGQThread=0, iGQHeld=0;
+unsigned long   ulGQMinGap, ulGQMaxGap, ulGQMinDigits, ulGQMaxDigits;
+#ifdef __PTHREADS__
+pthread_mutex_t mtxGQ=PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t  cvGQFull=PTHREAD_COND_INITIALIZER;
+pthread_cond_t  cvGQFree=PTHREAD_COND_INITIALIZER;
+pthread_t       thGQ;
+#endif
+
+/* Candidates of the interior scan in mpz_gap, tested in batches */
+
+mpz_t           *pmpzGB;
+unsigned long   *pulGB;
+int             *piGB;
+long            nGBMax=1;
+
+/* Pollard P-1 prefilter of the interior candidates (see NOTE 11) */
+
+mpz_t           mpzPM1E;
+unsigned long   ulPM1B1=0, ulPM1Tests=0, ulPM1Elim=0, ulSieveDiv=2;
+long            lPM1Env=-1;
+
+/* The last B1 of the cost model ulPMinus1B1 and its arguments, since
+   consecutive gaps of a list mostly share both (the model takes some
+   70000 evaluations of Dickman's function). */
+
+unsigned long   ulPM1ModelB1=0, ulPM1ModelBits=0, ulPM1ModelTD=0;
+
+/* Times of the phases of the current gap for plsRes (see NOTE (17)),
+   wall seconds in lfPhase[0..NPHASES-1] and processor seconds in
+   lfPhase[NPHASES..2*NPHASES-1], charged by vPhaseMark. */
+
+#define PH_PARSE    0
+#define PH_P1       1
+#define PH_SIEVE    2
+#define PH_INTERIOR 3
+#define PH_P2       4
+#define NPHASES     5
+
+static const char *szPhase[NPHASES]=
+  {"parse", "p1", "sieve", "interior", "p2"};
+double          lfPhase[2*NPHASES], lfPhW0, lfPhC0;
+
 static const char signature[]=
   "\n __cglp4.c__Version 2018.10.05.0010__Freeware copyright (c) 2018"
   "\n Thomas R. Nicely <http://www.trnicely.net>. Released into the"
@@ -192,14 +454,15 @@ static const char signature[]=
 /**********************************************************************/
 int main(int argc, char *argv[])
 {
-char             *szP1, *szP2, *szScratch, *pch, *ep, *ep2, ch,
-		 szP1tt[256], szP1t[256], szP1t2[256], szCmd[512], *pch2,
-                  *szInBuffer;
-long		 iStat, iEPO=0, iInterior=0, iG, iLen, ibs;
-unsigned long    lfMem, ulMinGap, ulMaxGap, ulMinDigits, ulMaxDigits,
-		 ulLen, ulD2, ulD1a, ulGap2, ulOK=0, ulErrors=0, ulFactor,
+char             *szP1, *pch, *ep, *ep2, ch,
+		 szP1tt[256], szP1t[256], szP1t2[256], szCmd[512], *pch2;
+long		 iStat, iEPO=0, iInterior=0, lLen;
+unsigned long    ulMinGap, ulMaxGap, ulMinDigits, ulMaxDigits,
+		 ulD1a, ulGap2, ulOK=0, ulErrors=0, ulFactor,
 		 ulChunk, ul;
 double           t1, t2, lf;
+struct __prpbatch_opts opts;
+struct gapq_slot *pgs;
 
 lft0=lfSeconds2();
 lfTstart=lft0;
@@ -210,30 +473,84 @@ if(argc==1)
   exit(EXIT_FAILURE);
   }
 
-iLen=__lRFile(argv[1]);  /* input file size */
-lfMem=lfPMA();
-ibs=__MIN2(iLen + 3, lfMem/4);
-szInBuffer=(char *)malloc(ibs);
-fpIn=fopen(argv[1], "rt");
-if(!fpIn)
+pglIn=pGapListOpen(argv[1]);  /* mapped, if possible; see trn.c */
+if(!pglIn)
   {
   fprintf(stderr,
     "\n ERROR: Unable to open specified input file %s.", argv[1]);
   exit(EXIT_FAILURE);
   }
-iStat=setvbuf(fpIn, szInBuffer, _IOFBF, ibs);  /* fully buffer input file */
 
-fpOut=fopen(OUTFILE, "at");
-if(!fpOut)
+/* OUTFILE is kept open, and the results are buffered, being written
+   out every second by default (see NOTE (15)). */
+
+ul=0;  /* records */
+lf=1;  /* seconds */
+pch=getenv("CGLP4_FLUSH");
+if(pch!=NULL)
+  {
+  lf=strtod(pch, &ep);
+  if((*ep != 's') && (*ep != 'S'))
+    {
+    ul=(lf < 1) ? 0 : lf;
+    lf=0;
+    }
+  }
+/* Files are committed to the disk on a thread of their own by default
+   (see NOTE (16)). */
+
+pch=getenv("CGLP4_DURABLE");
+if(pch!=NULL)
+  {
+  if(!strcmp(pch, "none") || !strcmp(pch, "0"))
+    iDurableMode(DURABLE_NONE);
+  else if(!strcmp(pch, "async") || !strcmp(pch, "1"))
+    iDurableMode(DURABLE_ASYNC);
+  else if(!strcmp(pch, "strict") || !strcmp(pch, "2"))
+    iDurableMode(DURABLE_STRICT);
+  else
+    {
+    fprintf(stderr, "\n ERROR: CGLP4_DURABLE must be none, async, or strict.");
+    exit(EXIT_FAILURE);
+    }
+  }
+plsOut=pLogOpen(OUTFILE, ul, lf);
+if(!plsOut)
   {
   fprintf(stderr, "\n ERROR: Unable to open output file %s.", OUTFILE);
   exit(EXIT_FAILURE);
   }
 else
   {
-  fprintf(fpOut, "=======================================");
-  fprintf(fpOut, "======================================\n");
-  fclose(fpOut);
+  iLogPrintf(plsOut, "=======================================");
+  iLogPrintf(plsOut, "======================================\n");
+  vLogRecord(plsOut);
+  }
+
+/* The results may also be written as JSONL or CSV (see NOTE (17)). */
+
+pch=getenv("CGLP4_RESULTS");
+if((pch!=NULL) && *pch)
+  {
+  ep=pch + strlen(pch);
+  iResCSV=(ep - pch >= 4) && !strcmpi(ep - 4, ".csv");
+  lLen=__lFile(pch);
+  plsRes=pLogOpen(pch, ul, lf);
+  if(!plsRes)
+    {
+    fprintf(stderr, "\n ERROR: Unable to open results file %s.", pch);
+    exit(EXIT_FAILURE);
+    }
+  if(iResCSV && (lLen <= 0))
+    {
+    iLogPrintf(plsRes,
+      "gap,digits,p1,verdict,detail,divisor,witness,gtrue,offset,tests");
+    for(i=0; i < 2*NPHASES; i++)
+      iLogPrintf(plsRes, ",%s_%s", (i < NPHASES) ? "wall" : "cpu",
+	szPhase[i % NPHASES]);
+    iLogPrintf(plsRes, "\n");
+    vLogRecord(plsRes);
+    }
   }
 fprintf(stdout, "\n");
 
@@ -269,7 +586,19 @@ if(iNumArgs > 2)
       exit(EXIT_FAILURE);
       }
     }
-  if((ch=='x') || (ch=='z') || (ch=='m') || (ch=='X') || (ch=='Z'))
+  if((ch=='e') || (ch=='E'))
+    {
+    iNoCheck=1;
+    pgboNoCheck=pGapBinCreate(NOCHECKBIN);
+    if(!pgboNoCheck)
+      {
+      fprintf(stderr, "\n ERROR: Unable to open nocheck file %s.",
+	NOCHECKBIN);
+      exit(EXIT_FAILURE);
+      }
+    }
+  if((ch=='x') || (ch=='z') || (ch=='m') || (ch=='X') || (ch=='Z')
+      || (ch=='e') || (ch=='E'))
     {
     iEPO=1;
     if(iNumArgs > 3)ulMinGap=strtoul(argv[3], NULL, 0);
@@ -296,12 +625,26 @@ if(iNumArgs > 2)
     }
   }
 if(iEPO)ulMRReps=1;
+
+/* Only the records within the selected ranges are read, by way of the
+   index of a binary gap list, or else the sidecar index of a text
+   list, if a range has been given (see lGapListSelect in trn.c). */
+
+pch=getenv("CGLP4_INDEX");
+if(pglIn->iBinary || (((pch==NULL) || atoi(pch))
+    && (ulMinGap || ulMinDigits || (ulMaxGap < 10*__MAX_DIGITS__)
+      || (ulMaxDigits < __MAX_DIGITS__))))
+  lGapListSelect(pglIn, ulMinGap, ulMaxGap, ulMinDigits, ulMaxDigits);
 pch=getenv("MRREPS");
 if(pch!=NULL)ulMRReps=strtoul(pch,NULL,0);
 if(ulMRReps > 999)ulMRReps=999;
 pch=getenv("INTERIOR");
 if(!iEPO && (pch!=NULL))iInterior=1;
 if(ulMRReps==0)ulMRReps=DEFAULT_BASES;
+pch=getenv("CGLP4_THREADS");
+if(pch!=NULL)iPoolThreads(atoi(pch) ? atoi(pch) : -1);
+pch=getenv("CGLP4_PM1");
+if(pch!=NULL)lPM1Env=atol(pch);
 pch=getenv("CGLP4_BACKUP");
 if(pch!=NULL)iBackupAll=1;
 pch=getenv("CGLP4BUI");
@@ -319,31 +662,57 @@ if(pch!=NULL)iCheckSieve=1;
 
 ulMD=__MAX_DIGITS__;  /* See trn.h */
 mpz_init(mpzP1);
+vGapRecInit(&grIn);
 mpz_init(mpzP2);
 mpz_init(mpz);
 mpz_init(mpzRem);
 mpz_init(mpzD);
 mpz_init(mpzR);
+mpz_init(mpzPM1E);
 mpz_init_set_ui(mpzTwo, 2);
-szBuffer=(char *)malloc(ulMD);
-szP1=(char *)malloc(ulMD);
-szP2=(char *)malloc(ulMD);
-szScratch=NULL;
-szScratch=(char *)malloc(ulMD);
-if(!szScratch)  /* This verifies all allocations to this point */
+if(iEPO)
   {
-  fprintf(stderr,
-    "\n ERROR: Unable to allocate szScratch array (%lu bytes).\n", ulMD);
-  exit(EXIT_FAILURE);
+  if(iPoolThreads(0) > 1)nEPOMax=4*iPoolThreads(0);
+  pEPO=(struct epo_rec *)malloc(nEPOMax*sizeof(struct epo_rec));
+  pmpzEPO=(mpz_t *)malloc(2*nEPOMax*sizeof(mpz_t));
+  piEPO=(int *)malloc(2*nEPOMax*sizeof(int));
+  if(!pEPO || !pmpzEPO || !piEPO)
+    {
+    fprintf(stderr, "\n ERROR: Unable to allocate the endpoint queue.\n");
+    exit(EXIT_FAILURE);
+    }
+  for(ul=0; ul < 2*nEPOMax; ul++)mpz_init(pmpzEPO[ul]);
+  }
+else
+  {
+  nGBMax=4*iPoolThreads(0);
+  pmpzGB=(mpz_t *)malloc(nGBMax*sizeof(mpz_t));
+  pulGB=(unsigned long *)malloc(nGBMax*sizeof(unsigned long));
+  piGB=(int *)malloc(nGBMax*sizeof(int));
+  if(!pmpzGB || !pulGB || !piGB)
+    {
+    fprintf(stderr, "\n ERROR: Unable to allocate the candidate batch.\n");
+    exit(EXIT_FAILURE);
+    }
+  for(ul=0; ul < nGBMax; ul++)mpz_init(pmpzGB[ul]);
   }
 
-/* Check for the presence of the Windows command-line pfgw code, 32-bit
-   or 64-bit. */
+/* Check for the presence of the command-line pfgw code: under Windows,
+   32-bit or 64-bit, and elsewhere on the PATH. */
 
 iPFGW=0;
 szPFGW[0]=0;
+pch=getenv("CGLP4_PFGW_CHUNK");
+if((pch!=NULL) && (atol(pch) > 0))ulPFGWChunk=atol(pch);
 pch=getenv("NOPFGW");  /* Is PFGW excluded by the environment? */
 if(pch!=NULL)goto PFGW_CHECKED;
+pch=getenv("CGLP4_PFGW");  /* PFGW, or a stand-in, named (NOTE (19)) */
+if((pch!=NULL) && *pch && (strlen(pch) < sizeof(szPFGW) - 1))
+  {
+  iPFGW=3;
+  sprintf(szPFGW, "%s ", pch);
+  goto PFGW_CHECKED;
+  }
 
 if(__lRFile("c:\\windows\\SysWOW64\\winver.exe") > 0)
   {
@@ -351,13 +720,13 @@ if(__lRFile("c:\\windows\\SysWOW64\\winver.exe") > 0)
     {
     iPFGW=2;
     strcpy(szPFGW,
-      "pfgw64 -k -r -f0 -e1 -r -u0 -Cquiet ");
+      "pfgw64 -k -r -f0 -e1 -r -u0 ");
     }
   else if(__lRFile("c:\\pfgw\\pfgw64.exe") > 0)
     {
     iPFGW=2;
     strcpy(szPFGW,
-      "c:\\pfgw\\pfgw64 -k -r -f0 -e1 -r -u0 -Cquiet ");
+      "c:\\pfgw\\pfgw64 -k -r -f0 -e1 -r -u0 ");
     }
   }
 
@@ -367,18 +736,46 @@ if(!iPFGW)  /* 64-bit PFGW not found */
     {
     iPFGW=1;
     strcpy(szPFGW,
-      "pfgw32 -k -r -f0 -e1 -r -u0 -Cquiet ");
+      "pfgw32 -k -r -f0 -e1 -r -u0 ");
     }
   else if(__lRFile("c:\\pfgw\\pfgw32.exe") > 0)
     {
     iPFGW=1;
     strcpy(szPFGW,
-      "c:\\pfgw\\pfgw32 -k -r -f0 -e1 -r -u0 -Cquiet ");
+      "c:\\pfgw\\pfgw32 -k -r -f0 -e1 -r -u0 ");
     }
   }
 
+#ifndef __WIN32__
+if(!iPFGW && (iOnPath("pfgw64", szPFGW) || iOnPath("pfgw", szPFGW)))
+  {
+  iPFGW=2;
+  strcat(szPFGW, " -k -r -f0 -e1 -r -u0 ");
+  }
+#endif
+
 PFGW_CHECKED: ;
 
+/* The provers of the interior of a gap, by its size (NOTE (20)); by
+   default, PFGW (if present) from MIN_PFGW_DIGITS, else GMP alone. */
+
+pch=getenv("CGLP4_PROVERS");
+if((pch!=NULL) && *pch)
+  vProvers(pch);
+else if(iPFGW)
+  {
+  pch=(char *)malloc(strlen(szPFGW) + 32);
+  if(!pch)
+    {
+    fprintf(stderr, "\n ERROR: Unable to allocate CGLP4_PROVERS.\n");
+    exit(EXIT_FAILURE);
+    }
+  sprintf(pch, "%lu:batch=%s", (unsigned long)MIN_PFGW_DIGITS, szPFGW);
+  pch[strlen(pch) - 1]=0;  /* less the trailing blank */
+  vProvers(pch);
+  free(pch);
+  }
+
 ulMG=__MAX2(ulMaxGap, 10*__MAX_DIGITS__);
 if(!iEPO)
   {
@@ -412,59 +809,39 @@ for(i=1; i < argc; i++)
   }
 if(iScreen)
   {
-  __clearline();
+  vProgressClear();
   printf("...Searching for specified gaps...");
   }
 
+/* The records are read, evaluated, and filtered ahead of the tests,
+   on a thread of their own unless CGLP4_READER=0 (see gqSlot). */
+
+ulGQMinGap=ulMinGap;
+ulGQMaxGap=ulMaxGap;
+ulGQMinDigits=ulMinDigits;
+ulGQMaxDigits=ulMaxDigits;
+pch=getenv("CGLP4_READER");
+vGapQStart((pch==NULL) || atoi(pch));
+
+/* Results printed directly in the loop below must not overtake those
+   of gaps still in the endpoint queue. */
+
+#define EPO_SYNC() {if(nEPO)vEPOFlush(&ulOK, &ulErrors);}
+
 while(1)  /* Check the candidate gaps one at a time */
   {
   iMR2ThisGap=iMR2Base;
   if(!iBackupAll)iBackup=0;
-  iStat=iGetGapRecExt(szBuffer, fpIn);
-  if(!iStat)
-    {
-    if(feof(fpIn))break;
-    continue;
-    }
-  iG=atol(szBuffer);  /* Check for valid gap measure iG */
-  if(iG <= 0)continue;
-  if(iG & 1)if(iG != 1)continue;
-  ulGap=strtoul(szBuffer, &ep, 10);  /* To locate ep for later use */
-  if((ulGap != iG) || (ulGap > 999999999UL))continue;
-  if(iStat==6)  // Standard format gap6 entry
-    {
-    ulD1=strtoul(szBuffer+32, NULL, 10);
-    strcpy(szP1, szBuffer+40);
-    }
-  else if(iStat==9)  // Standard format gap9 entry
-    {
-    ulD1=strtoul(szBuffer+37, NULL, 10);
-    strcpy(szP1, szBuffer+47);
-    }
-  else if(iStat==1)  // G and P1 only in entry (type 1)
-    {
-    szTrimMWS(ep);
-    pch=strstr(ep, "  ");
-    if(pch)*pch=0;
-    strcpy(szP1, ep);
-    szTrimMWS(szP1);
-    if(mpz_set_str(mpzP1, szP1, 10))  /* is it a literal? */
-      if(iEvalExpr(mpzP1, szP1))  /* is it a formula? */
-	{
-	sprintf(sz, "G=%7lu P1=%-20s ERROR: Unable to parse P1.\n",
-	  ulGap, szP1tt);
-	fprintf(stderr, "%s", sz);
-	fpOut=fopen(OUTFILE, "at");
-	fprintf(fpOut, sz);
-	fclose(fpOut);
-	continue;
-	}
-    ulD1=strlen(mpz_get_str(szScratch, 10, mpzP1));
-    }
-  else  /* Invalid or unrecognized record */
-    continue;
-  if(ulGap < ulMinGap)continue;
-  if(ulGap > ulMaxGap)break;
+  pgs=pGapQNext();  /* read, filtered, and evaluated by iGapQRead */
+  if(!pgs)break;
+  vPhaseStart(pgs->lfParse);
+  szBuffer=pgs->szRec;
+  szP1=pgs->szP1;
+  ulGap=pgs->ulGap;
+  ulD1=pgs->ulD1;
+  strcpy(szP1tt, pgs->szP1tt);
+  strcpy(szP1t2, pgs->szP1t2);
+  strcpy(szP1t, pgs->szP1t);
   sprintf(szSieveFile, "g%lu.siv", ulGap);
   sprintf(szDivFile, "g%lu.div", ulGap);
   sprintf(szBackupFile, "g%lu.bak", ulGap);
@@ -474,101 +851,68 @@ while(1)  /* Check the candidate gaps one at a time */
     iMR2ThisGap=0;
   if(ulD1 > 1999)iBackup=1;
   if(ulGap > 99999UL)iBackup=1;
-  if(strstr(szP1, ".."))continue;  /* Ellipsed prime---skip */
-  if((ulGap < ulMinGap) || (ulGap > ulMaxGap))continue;
-  if((ulD1 < ulMinDigits) || (ulD1 > ulMaxDigits))continue;
-  /* Make ellipsed forms of P1 for reporting */
-  szTrimMWS(szP1);
-  ulLen=strlen(szP1);
-  if(ulLen > 20)
+  if(pgs->iP1Bad)  /* Neither a literal nor a formula */
     {
-    sprintf(sz, "..(%luD)..", ulD1);
-    strncpy(szP1tt, szP1, 20-strlen(sz));
-    szP1tt[20-strlen(sz)]=0;
-    strcat(szP1tt, sz);
-    }
-  else
-    strcpy(szP1tt, szP1);
-  if(ulLen > 39)
-    {
-    sprintf(sz, "..(%luD)..", ulD1);
-    strncpy(szP1t2, szP1, 39-strlen(sz));
-    szP1t2[39-strlen(sz)]=0;
-    strcat(szP1t2, sz);
-    }
-  else
-    strcpy(szP1t2, szP1);
-  if(ulLen > 54)
-    {
-    sprintf(sz, "..(%luD)..", ulD1);
-    strncpy(szP1t, szP1, 54-strlen(sz));
-    szP1t[54-strlen(sz)]=0;
-    strcat(szP1t, sz);
-    }
-  else
-    strcpy(szP1t, szP1);
-  iStat=mpz_set_str(mpzP1, szP1, 10);  /* is it a literal? */
-  if(iStat)  /* Is it a formula? */
-    {
-    iStat=iEvalExpr(mpzP1, szP1);
-    if(iStat)
-      {
-      sprintf(sz, "G=%7lu P1=%-20s ERROR: Unable to parse P1.\n",
-	ulGap, szP1tt);
-      fprintf(stderr, "%s", sz);
-      fpOut=fopen(OUTFILE, "at");
-      fprintf(fpOut, sz);
-      fclose(fpOut);
-      continue;
-      }
+    EPO_SYNC();
+    sprintf(sz, "G=%7lu P1=%-20s ERROR: Unable to parse P1.\n",
+      ulGap, szP1tt);
+    vProgressLine(sz);
+    iLogPrintf(plsOut, sz);
+    vLogRecord(plsOut);
+    vResult(ulGap, ulD1, szP1, -1, "", "Unable to parse P1", 0, NULL, -1,
+      0);
+    continue;
     }
+  mpz_swap(mpzP1, pgs->mpzP1);
   if(mpz_cmp(mpzP1, mpzTwo) < 0)continue;
   if((ulGap==1) && mpz_cmp(mpzP1, mpzTwo))
     {
+    EPO_SYNC();
     ulErrors++;
     sprintf(sz, "G=%7lu P1=%-20s ERROR: P1 composite (%lu|P1) Gtrue=0\n",
       ulGap, szP1tt, 2UL);
-    fprintf(stderr, "%s", sz);
-    fpOut=fopen(OUTFILE, "at");
-    fprintf(fpOut, sz);
-    fclose(fpOut);
+    vProgressLine(sz);
+    iLogPrintf(plsOut, sz);
+    vLogRecord(plsOut);
+    vResult(ulGap, ulD1, szP1, -1, "", "P1 composite", 2, NULL, 0, 0);
     continue;
     }
   if((ulGap==1) && (!mpz_cmp(mpzP1, mpzTwo)))
     {
+    EPO_SYNC();
     if(iScreen)
       {
       dt=lfSeconds2() - lft0 + 0.000500000000001;
       sprintf(sz, "G=%7lu P1=%-39s OK certfd (%.3fs)\n", 1UL, "2", dt);
-      __clearline();
-      cputs(sz);
+      vProgressLine(sz);
       }
-    fpOut=fopen(OUTFILE, "at");
-    fprintf(fpOut, "G=%7lu P1=%-54s OK certfd\n", 1UL, "2");
-    fclose(fpOut);
+    iLogPrintf(plsOut, "G=%7lu P1=%-54s OK certfd\n", 1UL, "2");
+    vLogRecord(plsOut);
+    vResult(ulGap, ulD1, szP1, -1, "certfd", NULL, 0, NULL, -1, 0);
     ulOK++;
     continue;
     }
   if(ulGap & 1)
     {
+    EPO_SYNC();
     ulErrors++;
     sprintf(sz, "\n ERROR: G odd and G != 1 in the line:\n==>%s", szBuffer);
-    fprintf(stderr, "%s", sz);
-    fpOut=fopen(OUTFILE, "at");
-    fprintf(fpOut, sz);
-    fclose(fpOut);
+    vProgressLine(sz);
+    iLogPrintf(plsOut, sz);
+    vLogRecord(plsOut);
+    vResult(ulGap, ulD1, szP1, -1, "", "G odd", 0, NULL, -1, 0);
     continue;
     }
   if(mpz_even_p(mpzP1))
     {
+    EPO_SYNC();
     ulErrors++;
     sprintf(sz, "G=%7lu P1=%-20s ERROR: P1 composite (%lu|P1) Gtrue=0\n",
       ulGap, szP1tt, 2UL);
-    __clearline();
-    cputs(sz);
-    fpOut=fopen(OUTFILE, "at");
-    fprintf(fpOut, sz);
-    fclose(fpOut);
+    vProgressLine(sz);
+    iLogPrintf(plsOut, sz);
+    vLogRecord(plsOut);
+    vResult(ulGap, ulD1, szP1, -1, "", "P1 composite", 2, NULL, 0, 0);
     continue;
     }
   mpz_add_ui(mpzP2, mpzP1, ulGap);
@@ -576,27 +920,39 @@ while(1)  /* Check the candidate gaps one at a time */
 /*
  * Check the initiating prime P1.
  */
-  ulD1a=strlen(mpz_get_str(szScratch, 10, mpzP1));
+  ulD1a=pgs->ulD1a;
   if(ulD1a != ulD1)
     {
-    szBuffer[iSW-3]=0;
+    EPO_SYNC();
+    vProgressClear();
     fprintf(stderr, " ERROR: Conflicting counts of digits in this gap:");
-    fprintf(stderr, "\n\n %s...\n\n", szBuffer);
+    fprintf(stderr, "\n\n %.*s...\n\n", iSW-3, szBuffer);
     fprintf(stderr, " ...Stated number=%lu  Actual number=%lu\n",
       ulD1, ulD1a);
     ulErrors++;
+    vResult(ulGap, ulD1, szP1, -1, "", "Conflicting counts of digits", 0,
+      NULL, -1, 0);
     continue;
     }
   if(iNoCheck)  /* Just list the gaps that would have been checked */
     {
-    fprintf(fpNoCheck, "%s\n", szBuffer);
+    if(!pgboNoCheck)
+      fprintf(fpNoCheck, "%s\n", szBuffer);
+    else if(iGapBinWrite(pgboNoCheck, szBuffer, szP1, pgs->iType, ulGap,
+	ulD1, mpzP1))
+      {
+      fprintf(stderr, "\n ERROR: Unable to write nocheck file %s.",
+	NOCHECKBIN);
+      exit(EXIT_FAILURE);
+      }
     iNCGaps++;
     continue;
     }
   if(iEPO)
     {
-    iBackup=0;
-    goto CHECK_P1;
+    vEPOQueue(szP1, szP1tt, szP1t2, szP1t);
+    if(nEPO==nEPOMax)vEPOFlush(&ulOK, &ulErrors);
+    continue;
     }
   if(iInterior && !iBackup)goto INTERIOR;
   fpBackup=fopen(szBackupFile, "rt");
@@ -623,16 +979,20 @@ CHECK_P1: ;
     dt=lfSeconds2() - lft0 + 0.000500000000001;
     sprintf(sz, "G=%7lu ...Checking P1 (%luD)...", ulGap, ulD1);
     dt=lfSeconds2() - lft0 + 0.000500000000001;
-    sprintf(sz3, "%-62s (%.3fs)", sz, dt); sz3[iSW]=0;
-    __clearline();
-    cputs(sz3);
+    snprintf(sz3, sizeof(sz3), "%-62s (%.3fs)", sz, dt); sz3[iSW]=0;
+    vProgress(sz3);
     }
   if(iInterior)goto INTERIOR;
   if(ulD1 >= MIN_PFGW_DIGITS)vFlush();  /* Safety feature for power outages */
-  if(iMR2ThisGap)
-    iStat=iMillerRabin(mpzP1, 2);
-  else
-    iStat=iPrP(mpzP1, ulMRReps, 1000);
+  opts.ulNMR=ulMRReps;
+  opts.ulMaxDivisor=1000;
+  opts.iMR2=iMR2ThisGap;
+  opts.iFermat=0;
+  opts.iStopAtPrime=0;
+  vPhaseMark(-1);
+  iPrPBatch(&mpzP1, 1, &i, &opts);
+  vPhaseMark(PH_P1);
+  iStat=i;
   if(iStat==0)
     {
     ulErrors++;
@@ -653,95 +1013,30 @@ CHECK_P1: ;
 	  "G=%7lu P1=%-20s ERROR: P1 composite (xBPSW) Gtrue=0\n",
 	  ulGap, szP1tt);
       }
-    __clearline();
-    cputs(sz);
-    fpOut=fopen(OUTFILE, "at");
-    fprintf(fpOut, sz);
-    fclose(fpOut);
+    vProgressLine(sz);
+    iLogPrintf(plsOut, sz);
+    vLogRecord(plsOut);
+    vResult(ulGap, ulD1, szP1, iMR2ThisGap, "", "P1 composite",
+      (ulFactor > 1) ? ulFactor : 0,
+      (ulFactor > 1) ? NULL : (iStat ? "xBPSW" : "xMR2"), 0, 0);
     continue;
     }
   if(iScreen)
     {
-    if(iEPO)
-      {
-      ulD2=strlen(mpz_get_str(szScratch, 10, mpzP2));
-      sprintf(sz, "G=%7lu ...Checking P2 (%luD)...", ulGap, ulD2);
-      }
-    else
-      sprintf(sz, "G=%7lu ...Checking P1 (%luD) + 2...", ulGap, ulD1);
+    sprintf(sz, "G=%7lu ...Checking P1 (%luD) + 2...", ulGap, ulD1);
     dt=lfSeconds2() - lft0 + 0.000500000000001;
-    sprintf(sz3, "%-62s (%.3fs)", sz, dt); sz3[iSW]=0;
-    __clearline();
-    cputs(sz3);
-    }
-  if(iEPO)
-    {
-    if(iMR2ThisGap)
-      iStat=iMillerRabin(mpzP2, 2);
-    else
-      iStat=iPrP(mpzP2, ulMRReps, 1000);
-    if(iStat==0)
-      {
-      ulErrors++;
-      ulFactor=ulPrmDiv(mpzP2, 1000000UL);
-      if(ulFactor > 1)
-        sprintf(sz,
-          "G=%7lu P1=%-20s ERROR: P2 composite (%lu|P2) Gtrue=??\n",
-          ulGap, szP1tt, ulFactor);
-      else
-	{
-	iStat=iMillerRabin(mpzP2, 2);
-	if(iStat==0)
-	  sprintf(sz,
-	    "G=%7lu P1=%-20s ERROR: P2 composite (xMR2) Gtrue=??\n",
-	    ulGap, szP1tt);
-	else  /* MR2 passed but iPrP failed, so BPSW test failed P2 */
-	  sprintf(sz,
-	    "G=%7lu P1=%-20s ERROR: P2 composite (xBPSW) Gtrue=??\n",
-	    ulGap, szP1tt);
-	}
-      __clearline();
-      cputs(sz);
-      fpOut=fopen(OUTFILE, "at");
-      fprintf(fpOut, sz);
-      fclose(fpOut);
-      }
-    else
-      {
-      ulOK++;
-      if(iScreen)
-	{
-	dt=lfSeconds2() - lft0 + 0.000500000000001;
-	sprintf(sz, "G=%7lu P1=%-39s OK epo", ulGap, szP1t2);
-	if(iMR2ThisGap)
-	  sprintf(sz2, "MR2");
-	else
-	  sprintf(sz2, "B*%lu", ulMRReps);
-	strcat(sz, sz2);
-	sprintf(sz3, "%-62s (%.3fs)\n", sz, dt);
-	__clearline();
-	cputs(sz3);
-	}
-      fpOut=fopen(OUTFILE, "at");
-      fprintf(fpOut, "G=%7lu P1=%-54s OK epo", ulGap, szP1t);
-      if(iMR2ThisGap)
-        fprintf(fpOut, "MR2\n");
-      else
-        fprintf(fpOut, "B*%lu\n", ulMRReps);
-      fclose(fpOut);
-      }
-    continue;
+    snprintf(sz3, sizeof(sz3), "%-62s (%.3fs)", sz, dt); sz3[iSW]=0;
+    vProgress(sz3);
     }
 INTERIOR: ;
   /* Now treat full gap analysis (non-EPO) */
   lfLastBackupTime=lfSeconds2();
-  if(iPFGW && (ulD1 >= MIN_PFGW_DIGITS))
-    ulGap2=mpz_gap_pfgw();
-  else
-    ulGap2=mpz_gap();
+  ulGap2=mpz_gap();
   if(ulGap2 != ulGap)
     {
     ulErrors++;
+    ulFactor=0;
+    iStat=0;
     if(ulGap2 < ulGap)
       sprintf(sz,
 	"G=%7lu P1=%-20s ERROR: Intermediate prime at P1 + %lu\n",
@@ -766,11 +1061,16 @@ INTERIOR: ;
 	    ulGap, szP1tt, ulGap2);
 	}
       }
-    __clearline();
-    cputs(sz);
-    fpOut=fopen(OUTFILE, "at");
-    fprintf(fpOut, sz);
-    fclose(fpOut);
+    vProgressLine(sz);
+    iLogPrintf(plsOut, sz);
+    vLogRecord(plsOut);
+    if(ulGap2 < ulGap)
+      vResult(ulGap, ulD1, szP1, iMR2ThisGap, iInterior ? "int" : "",
+	"Intermediate prime", 0, NULL, ulGap2, ulGap2);
+    else
+      vResult(ulGap, ulD1, szP1, iMR2ThisGap, iInterior ? "int" : "",
+	"P2 composite", (ulFactor > 1) ? ulFactor : 0,
+	(ulFactor > 1) ? NULL : (iStat ? "xBPSW" : "xMR2"), ulGap2, 0);
     }
   else
     {
@@ -787,36 +1087,47 @@ INTERIOR: ;
       dt=lfSeconds2() - lft0 + 0.000500000000001;
       lft0=lfSeconds2();
       sprintf(sz3, "%-62s (%.3fs)\n", sz, dt);
-      __clearline();
-      cputs(sz3);
+      vProgressLine(sz3);
       }
-    fpOut=fopen(OUTFILE, "at");
-    fprintf(fpOut, "G=%7lu P1=%-54s OK ", ulGap, szP1t);
+    iLogPrintf(plsOut, "G=%7lu P1=%-54s OK ", ulGap, szP1t);
     if(iMR2ThisGap)
-      fprintf(fpOut, "MR2\n");
+      iLogPrintf(plsOut, "MR2\n");
     else
-      fprintf(fpOut, "BPSW*%lu\n", ulMRReps);
-    fclose(fpOut);
+      iLogPrintf(plsOut, "BPSW*%lu\n", ulMRReps);
+    vLogRecord(plsOut);
+    vResult(ulGap, ulD1, szP1, iMR2ThisGap, iInterior ? "int" : "", NULL,
+      0, NULL, -1, 0);
     }
   if(ulD1 >= MIN_PFGW_DIGITS)vFlush();  /* Safety feature for power outages */
   }  /* Process the next gap */
-
-__clearline();
-fpOut=fopen(OUTFILE, "at");
-fprintf(fpOut, "=======================================");
-fprintf(fpOut, "======================================\n");
+EPO_SYNC();
+vGapQStop();
+vGapListClose(pglIn);
+vGapRecClear(&grIn);
+
+vProgressClear();
+iLogPrintf(plsOut, "=======================================");
+iLogPrintf(plsOut, "======================================\n");
 dt=lfSeconds2()-lfTstart + 0.005000000000001;
-fprintf(fpOut, " Errors=%lu.  OK=%lu.  T=%.3f seconds.\n", ulErrors,
+iLogPrintf(plsOut, " Errors=%lu.  OK=%lu.  T=%.3f seconds.\n", ulErrors,
   ulOK, dt);
-fprintf(fpOut, " Input=%s.  CL==>%s<==.\n", argv[1], szCmd);
-fprintf(fpOut, "=======================================");
-fprintf(fpOut, "======================================\n");
-fclose(fpOut);
+if(ulPM1Tests)
+  iLogPrintf(plsOut, " P-1 prefilter: %lu of %lu candidates eliminated.\n",
+    ulPM1Elim, ulPM1Tests);
+iLogPrintf(plsOut, " Input=%s.  CL==>%s<==.\n", argv[1], szCmd);
+iLogPrintf(plsOut, "=======================================");
+iLogPrintf(plsOut, "======================================\n");
+iLogClose(plsOut);
+if(plsRes)iLogClose(plsRes);
+for(i=0; i < nProvers; i++)vProverClose(pprTab[i]);
 vFlush();
 if(!iNoCheck)
   {
   fprintf(stderr,
     "\n Errors=%lu.  OK=%lu.  T=%.3f seconds.", ulErrors, ulOK, dt);
+  if(ulPM1Tests)
+    fprintf(stderr, "\n P-1 prefilter: %lu of %lu candidates eliminated.",
+      ulPM1Elim, ulPM1Tests);
   fprintf(stderr, "\n Input=%s.  Output=%s.", argv[1], OUTFILE);
   fprintf(stderr, "\n CL==>%s<==.\n", szCmd);
   }
@@ -825,50 +1136,595 @@ else
   vFlush();
   remove(OUTFILE);
   vFlush();
+  if(pgboNoCheck && iGapBinClose(pgboNoCheck))
+    {
+    fprintf(stderr, "\n ERROR: Unable to write nocheck file %s.",
+      NOCHECKBIN);
+    exit(EXIT_FAILURE);
+    }
   if(iNCGaps)
     {
-    fprintf(stderr, " ...See %s for the %d selected gaps.", NOCHECKFILE,
-      iNCGaps);
+    fprintf(stderr, " ...See %s for the %d selected gaps.",
+      pgboNoCheck ? NOCHECKBIN : NOCHECKFILE, iNCGaps);
     }
   else
     {
     fprintf(stderr, " ...No such gaps were found.");
-    fclose(fpNoCheck);
+    if(fpNoCheck)fclose(fpNoCheck);
     vFlush();
-    remove(NOCHECKFILE);
+    remove(pgboNoCheck ? NOCHECKBIN : NOCHECKFILE);
     vFlush();
     }
   }
 return(EXIT_SUCCESS);
 }
 /**********************************************************************/
+static int iGapQRead(struct gapq_slot *pgs)
+{
+/* Reads the next record of pglIn within the selected ranges into *pgs,
+   as described above gqSlot, skipping without comment those which the
+   main loop would skip (invalid, ellipsed, or out of range). Each
+   record is parsed once, in place; the P1 of a type 1 record (G and P1
+   only) is evaluated in validating it, and any other only if the
+   record passes the range tests (see iGetGapRecObj). Returns 1, or 0
+   at the end of the list. Only the reader calls iGetGapRecObj, the
+   expression parser, or __mpz_ndigits10, none of which is reentrant. */
+
+char *szP1, szD[32];
+size_t ulLen;
+int iStat;
+double lfW, lfC, lf;
+
+lfW=lfPhaseSeconds(&lfC, 1);
+while(1)
+  {
+  iStat=iGetGapRecObj(pglIn, &grIn);
+  if(iStat < 0)return(0);
+  if(!iStat)continue;  /* Invalid or unrecognized record */
+  if((grIn.ulGap < ulGQMinGap) || (grIn.ulGap > ulGQMaxGap))continue;
+  if(strstr(grIn.szP1, ".."))continue;  /* Ellipsed prime---skip */
+  if((grIn.ulD1 < ulGQMinDigits) || (grIn.ulD1 > ulGQMaxDigits))continue;
+  break;
+  }
+pgs->iType=iStat;
+pgs->ulGap=grIn.ulGap;
+pgs->ulD1=grIn.ulD1;
+
+/* Copy the record, which the list may overwrite */
+
+szTrimMWS(grIn.szP1);
+ulLen=strlen(grIn.szRec);
+if(ulLen >= pgs->ulRecMax)
+  {
+  free(pgs->szRec);
+  pgs->ulRecMax=ulLen + 1024;
+  pgs->szRec=(char *)malloc(pgs->ulRecMax);
+  if(!pgs->szRec)
+    {
+    fprintf(stderr, "\n ERROR: Unable to allocate record buffer.\n");
+    exit(EXIT_FAILURE);
+    }
+  }
+memcpy(pgs->szRec, grIn.szRec, ulLen + 1);
+pgs->szP1=szP1=pgs->szRec + (grIn.szP1 - grIn.szRec);
+
+/* Make ellipsed forms of P1 for reporting */
+
+ulLen=strlen(szP1);
+sprintf(szD, "..(%luD)..", pgs->ulD1);
+if(ulLen > 20)
+  {
+  strncpy(pgs->szP1tt, szP1, 20-strlen(szD));
+  pgs->szP1tt[20-strlen(szD)]=0;
+  strcat(pgs->szP1tt, szD);
+  }
+else
+  strcpy(pgs->szP1tt, szP1);
+if(ulLen > 39)
+  {
+  strncpy(pgs->szP1t2, szP1, 39-strlen(szD));
+  pgs->szP1t2[39-strlen(szD)]=0;
+  strcat(pgs->szP1t2, szD);
+  }
+else
+  strcpy(pgs->szP1t2, szP1);
+if(ulLen > 54)
+  {
+  strncpy(pgs->szP1t, szP1, 54-strlen(szD));
+  pgs->szP1t[54-strlen(szD)]=0;
+  strcat(pgs->szP1t, szD);
+  }
+else
+  strcpy(pgs->szP1t, szP1);
+
+pgs->iP1Bad=iGapRecP1(&grIn);  /* Is it a literal or a formula? */
+pgs->ulD1a=0;
+if(!pgs->iP1Bad)
+  {
+  mpz_swap(pgs->mpzP1, grIn.mpzP1);
+  if(mpz_cmp_ui(pgs->mpzP1, 2) >= 0)pgs->ulD1a=__mpz_ndigits10(pgs->mpzP1);
+  }
+pgs->lfParse[0]=lfPhaseSeconds(&lf, 1) - lfW;
+pgs->lfParse[1]=lf - lfC;
+return(1);
+}
+/**********************************************************************/
+#ifdef __PTHREADS__
+static void *pvGapQReader(void *pv)
+{
+/* The reader thread: fills the free slots of gqSlot in turn. */
+
+long l=0;
+int iMore=1;
+
+while(iMore)
+  {
+  pthread_mutex_lock(&mtxGQ);
+  while(lGQFull==GAPQ_SLOTS)pthread_cond_wait(&cvGQFree, &mtxGQ);
+  pthread_mutex_unlock(&mtxGQ);
+  iMore=iGapQRead(gqSlot + l);
+  pthread_mutex_lock(&mtxGQ);
+  if(iMore)
+    lGQFull++;
+  else
+    iGQEOF=1;
+  pthread_cond_signal(&cvGQFull);
+  pthread_mutex_unlock(&mtxGQ);
+  l=(l + 1) % GAPQ_SLOTS;
+  }
+return(pv);
+}
+#endif
+/**********************************************************************/
+static void vGapQStart(int iThread)
+{
+/* Prepares the queue and, if iThread is nonzero (and threads are
+   supported), starts the reader thread; otherwise, pGapQNext reads
+   each record itself. The ranges are those of main. */
+
+long l;
+
+for(l=0; l < GAPQ_SLOTS; l++)mpz_init(gqSlot[l].mpzP1);
+#ifdef __PTHREADS__
+if(iThread && !iThreadCreate(&thGQ, pvGapQReader, NULL))
+  iGQThread=1;
+#endif
+return;
+}
+/**********************************************************************/
+static struct gapq_slot *pGapQNext(void)
+{
+/* Releases the slot taken by the previous call, and returns the next
+   record of the queue, waiting for the reader if need be, or NULL at
+   the end of the list. */
+
+#ifdef __PTHREADS__
+struct gapq_slot *pgs=NULL;
+
+if(iGQThread)
+  {
+  pthread_mutex_lock(&mtxGQ);
+  if(iGQHeld)
+    {
+    lGQHead=(lGQHead + 1) % GAPQ_SLOTS;
+    lGQFull--;
+    iGQHeld=0;
+    pthread_cond_signal(&cvGQFree);
+    }
+  while(!lGQFull && !iGQEOF)pthread_cond_wait(&cvGQFull, &mtxGQ);
+  if(lGQFull)
+    {
+    pgs=gqSlot + lGQHead;
+    iGQHeld=1;
+    }
+  pthread_mutex_unlock(&mtxGQ);
+  return(pgs);
+  }
+#endif
+
+return(iGapQRead(gqSlot) ? gqSlot : NULL);
+}
+/**********************************************************************/
+static void vGapQStop(void)
+{
+/* Waits for the reader thread (which has reached the end of the list,
+   pGapQNext having returned NULL), and frees the queue. */
+
+long l;
+
+#ifdef __PTHREADS__
+if(iGQThread)pthread_join(thGQ, NULL);
+iGQThread=0;
+#endif
+for(l=0; l < GAPQ_SLOTS; l++)
+  {
+  mpz_clear(gqSlot[l].mpzP1);
+  free(gqSlot[l].szRec);
+  gqSlot[l].szRec=NULL;
+  gqSlot[l].ulRecMax=0;
+  }
+return;
+}
+/**********************************************************************/
+static void vEPOQueue(char *szP1, char *szP1tt, char *szP1t2, char *szP1t)
+{
+/* Append the current gap (mpzP1, mpzP2, ulGap, ulD1, iMR2ThisGap)
+   to the endpoint queue, which the caller flushes when full. P1 in
+   full, and the time taken to read it, are kept only for plsRes. */
+
+struct epo_rec *pe=pEPO + nEPO;
+
+mpz_set(pmpzEPO[2*nEPO], mpzP1);
+mpz_set(pmpzEPO[2*nEPO + 1], mpzP2);
+nEPO++;
+pe->ulGap=ulGap;
+pe->ulD1=ulD1;
+pe->iMR2=iMR2ThisGap;
+strcpy(pe->szP1tt, szP1tt);
+strcpy(pe->szP1t2, szP1t2);
+strcpy(pe->szP1t, szP1t);
+pe->szP1=NULL;
+if(plsRes)
+  {
+  pe->szP1=(char *)malloc(strlen(szP1) + 1);
+  if(pe->szP1)strcpy(pe->szP1, szP1);
+  pe->lfParse[0]=lfPhase[PH_PARSE];
+  pe->lfParse[1]=lfPhase[NPHASES + PH_PARSE];
+  }
+return;
+}
+/**********************************************************************/
+static void vEPOFlush(unsigned long *pulOK, unsigned long *pulErrors)
+{
+/* Test the endpoints of all the queued gaps, concurrently if the
+   thread pool has more than one thread, and report the results in
+   the order the gaps were queued. Each run of consecutive gaps
+   with the same test (BPSW or MR2) is one iPrPBatch call. */
+
+struct epo_rec *pe;
+struct __prpbatch_opts opts;
+unsigned long ulFactor;
+long l, l2;
+int iStat;
+double lfSave[2*NPHASES], lfW, lfC;
+
+if(nEPO==0)return;
+memcpy(lfSave, lfPhase, sizeof(lfPhase));  /* the gap in hand */
+if(iScreen)
+  {
+  if(nEPO==1)
+    sprintf(sz, "G=%7lu ...Checking P1, P2 (%luD)...", pEPO->ulGap,
+      pEPO->ulD1);
+  else
+    sprintf(sz, "G=%7lu ...Checking P1, P2 of %ld gaps (%luD)...",
+      pEPO->ulGap, nEPO, pEPO->ulD1);
+  dt=lfSeconds2() - lft0 + 0.000500000000001;
+  snprintf(sz3, sizeof(sz3), "%-62s (%.3fs)", sz, dt); sz3[iSW]=0;
+  vProgress(sz3);
+  }
+for(l=0; l < nEPO; l++)  /* Safety feature for power outages */
+  if(pEPO[l].ulD1 >= MIN_PFGW_DIGITS)
+    {
+    vFlush();
+    break;
+    }
+
+opts.ulNMR=ulMRReps;
+opts.ulMaxDivisor=1000;
+opts.iFermat=0;
+opts.iStopAtPrime=0;
+vPhaseMark(-1);
+for(l=0; l < nEPO; l=l2)
+  {
+  for(l2=l+1; (l2 < nEPO) && (pEPO[l2].iMR2==pEPO[l].iMR2); l2++);
+  opts.iMR2=pEPO[l].iMR2;
+  iPrPBatch(pmpzEPO + 2*l, 2*(l2 - l), piEPO + 2*l, &opts);
+  }
+memset(lfPhase, 0, sizeof(lfPhase));
+vPhaseMark(PH_P1);
+lfW=lfPhase[PH_P1]/(2*nEPO);  /* shared equally among the endpoints */
+lfC=lfPhase[NPHASES + PH_P1]/(2*nEPO);
+
+for(l=0; l < nEPO; l++)
+  {
+  pe=pEPO + l;
+  lfPhase[PH_PARSE]=pe->lfParse[0];
+  lfPhase[NPHASES + PH_PARSE]=pe->lfParse[1];
+  lfPhase[PH_P1]=lfPhase[PH_P2]=lfW;
+  lfPhase[NPHASES + PH_P1]=lfPhase[NPHASES + PH_P2]=lfC;
+  if(piEPO[2*l]==0)
+    {
+    (*pulErrors)++;
+    ulFactor=ulPrmDiv(pmpzEPO[2*l], 1000000UL);
+    if(ulFactor > 1)
+      sprintf(sz,
+	"G=%7lu P1=%-20s ERROR: P1 composite (%lu|P1) Gtrue=0\n",
+	pe->ulGap, pe->szP1tt, ulFactor);
+    else
+      {
+      iStat=iMillerRabin(pmpzEPO[2*l], 2);
+      if(iStat==0)
+	sprintf(sz,
+	  "G=%7lu P1=%-20s ERROR: P1 composite (xMR2) Gtrue=0\n",
+	  pe->ulGap, pe->szP1tt);
+      else  /* MR2 passed but iPrP failed, so BPSW test failed P1 */
+	sprintf(sz,
+	  "G=%7lu P1=%-20s ERROR: P1 composite (xBPSW) Gtrue=0\n",
+	  pe->ulGap, pe->szP1tt);
+      }
+    vProgressLine(sz);
+    iLogPrintf(plsOut, sz);
+    vLogRecord(plsOut);
+    vResult(pe->ulGap, pe->ulD1, pe->szP1, pe->iMR2, "epo", "P1 composite",
+      (ulFactor > 1) ? ulFactor : 0,
+      (ulFactor > 1) ? NULL : (iStat ? "xBPSW" : "xMR2"), 0, 0);
+    }
+  else if(piEPO[2*l + 1]==0)
+    {
+    (*pulErrors)++;
+    ulFactor=ulPrmDiv(pmpzEPO[2*l + 1], 1000000UL);
+    if(ulFactor > 1)
+      sprintf(sz,
+	"G=%7lu P1=%-20s ERROR: P2 composite (%lu|P2) Gtrue=??\n",
+	pe->ulGap, pe->szP1tt, ulFactor);
+    else
+      {
+      iStat=iMillerRabin(pmpzEPO[2*l + 1], 2);
+      if(iStat==0)
+	sprintf(sz,
+	  "G=%7lu P1=%-20s ERROR: P2 composite (xMR2) Gtrue=??\n",
+	  pe->ulGap, pe->szP1tt);
+      else  /* MR2 passed but iPrP failed, so BPSW test failed P2 */
+	sprintf(sz,
+	  "G=%7lu P1=%-20s ERROR: P2 composite (xBPSW) Gtrue=??\n",
+	  pe->ulGap, pe->szP1tt);
+      }
+    vProgressLine(sz);
+    iLogPrintf(plsOut, sz);
+    vLogRecord(plsOut);
+    vResult(pe->ulGap, pe->ulD1, pe->szP1, pe->iMR2, "epo", "P2 composite",
+      (ulFactor > 1) ? ulFactor : 0,
+      (ulFactor > 1) ? NULL : (iStat ? "xBPSW" : "xMR2"), -1, 0);
+    }
+  else
+    {
+    (*pulOK)++;
+    if(iScreen)
+      {
+      dt=lfSeconds2() - lft0 + 0.000500000000001;
+      sprintf(sz, "G=%7lu P1=%-39s OK epo", pe->ulGap, pe->szP1t2);
+      if(pe->iMR2)
+	sprintf(sz2, "MR2");
+      else
+	sprintf(sz2, "B*%lu", ulMRReps);
+      strcat(sz, sz2);
+      sprintf(sz3, "%-62s (%.3fs)\n", sz, dt);
+      vProgressLine(sz3);
+      }
+    iLogPrintf(plsOut, "G=%7lu P1=%-54s OK epo", pe->ulGap, pe->szP1t);
+    if(pe->iMR2)
+      iLogPrintf(plsOut, "MR2\n");
+    else
+      iLogPrintf(plsOut, "B*%lu\n", ulMRReps);
+    vLogRecord(plsOut);
+    vResult(pe->ulGap, pe->ulD1, pe->szP1, pe->iMR2, "epo", NULL, 0, NULL,
+      -1, 0);
+    }
+  free(pe->szP1);
+  pe->szP1=NULL;
+  }
+nEPO=0;
+memcpy(lfPhase, lfSave, sizeof(lfPhase));
+
+return;
+}
+/**********************************************************************/
+static void vPhaseStart(double *plfParse)
+{
+/* Begins the timing of a gap for plsRes, the time taken to read it
+   being plfParse[0] (wall) and plfParse[1] (processor). */
+
+if(!plsRes)return;
+memset(lfPhase, 0, sizeof(lfPhase));
+lfPhase[PH_PARSE]=plfParse[0];
+lfPhase[NPHASES + PH_PARSE]=plfParse[1];
+vPhaseMark(-1);
+return;
+}
+/**********************************************************************/
+static void vPhaseMark(int iPhase)
+{
+/* Charges the time since the previous mark to phase iPhase of the
+   current gap, or to none if iPhase < 0 (for plsRes). A phase may be
+   long, so that any status held back by vProgress is shown now. */
+
+double lfW, lfC;
+
+vProgressFlush();
+if(!plsRes)return;
+lfW=lfPhaseSeconds(&lfC, 0);
+if(iPhase >= 0)
+  {
+  lfPhase[iPhase] += lfW - lfPhW0;
+  lfPhase[NPHASES + iPhase] += lfC - lfPhC0;
+  }
+lfPhW0=lfW;
+lfPhC0=lfC;
+return;
+}
+/**********************************************************************/
+static void vResultStr(const char *sz)
+{
+/* Writes sz to plsRes as a quoted JSON or CSV string. */
+
+const char *pch;
+
+iLogPrintf(plsRes, "\"");
+while(*sz)
+  {
+  for(pch=sz; *pch && (*pch != '"') && (iResCSV || ((*pch != '\\')
+    && ((unsigned char)*pch >= 0x20))); pch++);
+  if(pch > sz)iLogPrintf(plsRes, "%.*s", (int)(pch - sz), sz);
+  if(!*pch)break;
+  if(iResCSV)
+    iLogPrintf(plsRes, "\"\"");
+  else if((*pch=='"') || (*pch=='\\'))
+    iLogPrintf(plsRes, "\\%c", *pch);
+  else
+    iLogPrintf(plsRes, "\\u%04x", (unsigned char)*pch);
+  sz=pch + 1;
+  }
+iLogPrintf(plsRes, "\"");
+return;
+}
+/**********************************************************************/
+static void vResult(unsigned long ulG, unsigned long ulD, char *szP1,
+  int iMR2, const char *szMode, const char *szDetail,
+  unsigned long ulDivisor, const char *szWitness, long lGtrue,
+  unsigned long ulOffset)
+{
+/* Writes a result to plsRes (see NOTE (17)), if open: the gap ulG of
+   ulD digits stated, starting at szP1, found OK if szDetail is NULL,
+   and otherwise in error as szDetail describes. The error is further
+   described by a small divisor ulDivisor, or the test szWitness which
+   failed (xMR2 or xBPSW), the true gap lGtrue, and the offset
+   ulOffset of an intermediate prime; each is omitted if 0, NULL, -1,
+   or 0 respectively. The tests are iMR2 (MR2 if 1, BPSW if 0, none if
+   -1) preceded by szMode (int, epo, certfd, or ""). The times are
+   those of lfPhase. */
+
+char szTests[64], szNum[32];
+const char *szNull;
+int i;
+
+if(!plsRes)return;
+
+strcpy(szTests, szMode);
+if(iMR2 >= 0)
+  {
+  if(*szTests)strcat(szTests, " ");
+  if(iMR2)
+    strcat(szTests, "MR2");
+  else
+    sprintf(szTests + strlen(szTests), "BPSW*%lu", ulMRReps);
+  }
+
+if(iResCSV)
+  {
+  szNull="";
+  iLogPrintf(plsRes, "%lu,%lu,", ulG, ulD);
+  vResultStr(szP1 ? szP1 : "");
+  iLogPrintf(plsRes, ",%s,", szDetail ? "ERROR" : "OK");
+  if(szDetail)vResultStr(szDetail);
+  iLogPrintf(plsRes, ",");
+  }
+else
+  {
+  szNull="null";
+  iLogPrintf(plsRes, "{\"gap\":%lu,\"digits\":%lu,\"p1\":", ulG, ulD);
+  vResultStr(szP1 ? szP1 : "");
+  iLogPrintf(plsRes, ",\"verdict\":\"%s\",\"detail\":",
+    szDetail ? "ERROR" : "OK");
+  if(szDetail)
+    vResultStr(szDetail);
+  else
+    iLogPrintf(plsRes, "null");
+  iLogPrintf(plsRes, ",\"divisor\":");
+  }
+
+sprintf(szNum, "%lu", ulDivisor);
+iLogPrintf(plsRes, "%s", ulDivisor ? szNum : szNull);
+iLogPrintf(plsRes, iResCSV ? "," : ",\"witness\":");
+if(szWitness)
+  vResultStr(szWitness);
+else
+  iLogPrintf(plsRes, "%s", szNull);
+iLogPrintf(plsRes, iResCSV ? "," : ",\"gtrue\":");
+sprintf(szNum, "%ld", lGtrue);
+iLogPrintf(plsRes, "%s", (lGtrue >= 0) ? szNum : szNull);
+iLogPrintf(plsRes, iResCSV ? "," : ",\"offset\":");
+sprintf(szNum, "%lu", ulOffset);
+iLogPrintf(plsRes, "%s", ulOffset ? szNum : szNull);
+iLogPrintf(plsRes, iResCSV ? "," : ",\"tests\":");
+vResultStr(szTests);
+
+if(iResCSV)
+  for(i=0; i < 2*NPHASES; i++)iLogPrintf(plsRes, ",%.6f", lfPhase[i]);
+else
+  {
+  for(i=0; i < 2*NPHASES; i++)
+    iLogPrintf(plsRes, "%s\"%s\":%.6f",
+      (i==0) ? ",\"wall\":{" : ((i==NPHASES) ? "},\"cpu\":{" : ","),
+      szPhase[i % NPHASES], lfPhase[i]);
+  iLogPrintf(plsRes, "}}");
+  }
+iLogPrintf(plsRes, "\n");
+vLogRecord(plsRes);
+return;
+}
+/**********************************************************************/
 static unsigned long mpz_gap(void)
 {
 /* mpzP1 is presumed the initial prime (previously verified) of a gap,
    and the return value is ulG, the distance to the succeeding prime
    mpzP2. */
 
-int iStat, iCount, iPrintCount, iTest;
-unsigned long ulG;
-double tnow, Tgap, Ttotal;
+int iCount, iPrintCount, iTest;
+unsigned long ulG, ul, ulBits;
+long l, nGB;
+struct __prpbatch_opts opts;
+struct __prover *ppr;
 
 if(mpz_cmp_ui(mpzP1, 2)==0)return(1);
+ppr=pProverFor(ulD1);  /* an external prover (NOTE (20)) */
+if(ppr)return(mpz_gap_ext(ppr));
 
 if(iScreen)
   {
   sprintf(sz, "G=%7lu ...Checking P1 (%luD) + %lu...sieving...",
     ulGap, ulD1, ulGBack);
   dt=lfSeconds2() - lft0 + 0.000500000000001;
-  sprintf(sz2, "%-62s (%.3fs)", sz, dt);
-  __clearline();
-  cputs(sz2);
+  snprintf(sz2, sizeof(sz2), "%-62s (%.3fs)", sz, dt);
+  vProgress(sz2);
   }
 
+vPhaseMark(-1);
 vSieve2();
+vPhaseMark(PH_SIEVE);
 
+/* The P-1 prefilter (iPMinus1) is applied to the sieve survivors if
+   the cost model ulPMinus1B1 expects it to save time, or if forced by
+   CGLP4_PM1 (see NOTE 11). */
+
+ul=0;
+if(lPM1Env > 0)ul=__MIN2((unsigned long)lPM1Env, 65521UL);
+if(lPM1Env < 0)
+  {
+  ulBits=mpz_sizeinbase(mpzP1, 2);
+  if((ulBits != ulPM1ModelBits) || (ulSieveDiv != ulPM1ModelTD))
+    {
+    ulPM1ModelB1=ulPMinus1B1(ulBits, ulSieveDiv);
+    ulPM1ModelBits=ulBits;
+    ulPM1ModelTD=ulSieveDiv;
+    }
+  ul=ulPM1ModelB1;
+  }
+if(ul && (ul != ulPM1B1))vPMinus1Exp(mpzPM1E, ul);
+ulPM1B1=ul;
+
+/* The sieve survivors are collected in batches of nGBMax and tested
+   by iPrPBatch (Fermat's test, then iPrP), stopping at the first prime
+   in order. P2 itself is tested on its own, with MR2 if so requested. */
+
+opts.ulNMR=ulMRReps;
+opts.ulMaxDivisor=2;
+opts.iMR2=0;
+opts.iFermat=1;
+opts.iStopAtPrime=1;
 iPrintCount=floor((4200 - ulD1)/100);
+iCount=0;
+nGB=0;
 ulG=ulGBack;
-mpz_add_ui(mpz, mpzP1, ulG);  /* re-start point within gap */
 iInsideGap=1;
 
 while(1)
@@ -882,33 +1738,36 @@ while(1)
       {
       sprintf(sz, "G=%7lu ...Checking P1 (%luD) + %lu...", ulGap, ulD1, ulG);
       dt=lfSeconds2() - lft0;
-      sprintf(sz2, "%-62s (%.3fs)", sz, dt);
-      __clearline();
-      cputs(sz2);
+      snprintf(sz2, sizeof(sz2), "%-62s (%.3fs)", sz, dt);
+      vProgress(sz2);
       iCount=0;
       }
-    mpz_powm(mpzRem, mpzTwo, mpz, mpz);
-    iStat=mpz_cmp(mpzRem, mpzTwo);
-    if(iStat==0)
+    if(ulG != ulGap)
       {
-      if(ulG==ulGap)
-	{
-	if(iMR2ThisGap)
-	  {
-	  if(iMillerRabin(mpzP2, 2))break;
-	  }
-	else
-	  {
-	  if(iPrP(mpzP2, ulMRReps, 2))break;
-	  }
-	}
-      else
-	{
-	if(iPrP(mpz, ulMRReps, 2))break;
-	}
+      mpz_add_ui(pmpzGB[nGB], mpzP1, ulG);
+      pulGB[nGB++]=ulG;
       }
     }
-  mpz_add_ui(mpz, mpz, 2);
+  if(nGB && ((nGB==nGBMax) || (ulG==ulGap)))
+    {
+    if(ulPM1B1)nGB=lPMinus1Filter(nGB);
+    l=iPrPBatch(pmpzGB, nGB, piGB, &opts);
+    nGB=0;
+    if(l >= 0)
+      {
+      ulG=pulGB[l];
+      break;
+      }
+    }
+  if(iTest && (ulG==ulGap))
+    {
+    opts.iMR2=iMR2ThisGap;
+    vPhaseMark(PH_INTERIOR);
+    l=iPrPBatch(&mpzP2, 1, piGB, &opts);
+    vPhaseMark(PH_P2);
+    opts.iMR2=0;
+    if(l==0)break;
+    }
   ulG += 2;
   }
 
@@ -917,41 +1776,87 @@ if(!iCheckSieve)
   remove(szSieveFile);
   remove(szDivFile);
   }
+vPhaseMark(PH_INTERIOR);
 ulGBack=2;
 iInsideGap=0;
 
 return(ulG);
 }
 /**********************************************************************/
-static unsigned long mpz_gap_pfgw(void)
+static void vPMinus1Task(void *pv, long l)
+{
+/* Pool task: the P-1 prefilter of interior candidate l of the batch;
+   piGB[l] is set to 1 if a proper divisor was found. */
+
+mpz_t mpzF;
+
+mpz_init(mpzF);
+piGB[l]=iPMinus1(mpzF, pmpzGB[l], mpzPM1E);
+mpz_clear(mpzF);
+
+return;
+}
+/**********************************************************************/
+static long lPMinus1Filter(long nGB)
+{
+/* Applies the P-1 prefilter to the nGB candidates of the batch (on
+   the thread pool, if there is one), drops those found composite,
+   and returns the number remaining, in their original order. */
+
+long l, n;
+
+vPoolRun(vPMinus1Task, NULL, nGB);
+for(l=n=0; l < nGB; l++)
+  {
+  if(piGB[l])continue;
+  if(n < l)
+    {
+    mpz_swap(pmpzGB[n], pmpzGB[l]);
+    pulGB[n]=pulGB[l];
+    }
+  n++;
+  }
+ulPM1Tests += nGB;
+ulPM1Elim += nGB - n;
+
+return(n);
+}
+/**********************************************************************/
+static unsigned long mpz_gap_ext(struct __prover *ppr)
 {
 /* mpzP1 is presumed the initial prime (previously verified) of a gap,
    and the return value is ulG, the distance to the succeeding prime
-   mpzP2. Note that iScreen is not meaningful in conjunction with pfgw. */
-
-char ch, sz[128], szNFile[128], szPFGW1[128];
-int iStat, iTest, iPrintCount, iCount, iCount2, iBackupCount;
-unsigned long ulG, ulRP1, ulRmpz;
+   mpzP2. Note that iScreen is not meaningful in conjunction with pfgw.
+   The interior sieve survivors are passed to the external prover ppr
+   in chunks, one lProverTest for each (see NOTE (19) and NOTE (20));
+   the first chunk holds 64 survivors, and each is twice the last, up
+   to ulPFGWChunk, so that a gap which fails early costs little. The
+   first survivor reported prime is confirmed with iPrP. P2 is tested
+   here. */
+
+char sz[128], szNFile[128], szOFile[128];
+int iStat, iTest, *piPF;
+unsigned long ulG, *pulPF;
+long l, n, nMax;
 double tnow, Tgap, Ttotal;
 FILE *fpLocal;
 
 if(mpz_cmp_ui(mpzP1, 2)==0)return(1);
 
-/* Insert the gap size into the name of the temporary input file
-   for pfgw, to prevent parallel processing clashes. */
+/* Insert the gap size into the names of the temporary files of a
+   batch prover, to prevent parallel processing clashes. */
 
 sprintf(szNFile, "N%lu.dat", ulGap);
-sprintf(sz, "%s > nul", szNFile);
-strcpy(szPFGW1, szPFGW);
-strcat(szPFGW1, sz);
-
-if(ulD1 > 3999)
-  iPrintCount=1;
-else
-  iPrintCount=floor((4200 - ulD1)/100);
-
-if(iPrintCount < 1)iPrintCount=1;
-iBackupCount=10*iPrintCount;
+sprintf(szOFile, "N%lu.out", ulGap);
+strcpy(ppr->szIn, szNFile);
+strcpy(ppr->szOut, szOFile);
+pulPF=(unsigned long *)malloc(ulPFGWChunk*sizeof(unsigned long));
+piPF=(int *)malloc(ulPFGWChunk*sizeof(int));
+if(!pulPF || !piPF)
+  {
+  fprintf(stderr, "\n ERROR: Unable to allocate the prover chunk.\n");
+  exit(EXIT_FAILURE);
+  }
 
 ulG=ulGBack;
 
@@ -960,76 +1865,91 @@ sprintf(sz, "G=%7lu ...Checking P1 (%luD) + %lu...",
 if(ulG < 3)strcat(sz, "sieving...");
 dt=lfSeconds2() - lft0 + 0.000500000000001;
 sprintf(sz2, "%-62s (%.3fs)", sz, dt);
-__clearline();
-cputs(sz2);
+vProgress(sz2);
 
+vPhaseMark(-1);
 vSieve2();
+vPhaseMark(PH_SIEVE);
 
-mpz_add_ui(mpz, mpzP1, ulG);  /* re-start point within gap */
 iInsideGap=1;
-iCount=0;
-iCount2=0;
-ulRP1=mpz_fdiv_ui(mpzP1, 10000000UL);
+nMax=__MIN2(64, (long)ulPFGWChunk);
 
 while(1)
   {
-  iTest=(ulG >= 2*ulGap);
-  if(!iTest)iTest=uchSieve[(ulG - 2)/2];
-  if(iTest)
+  /* The next chunk of survivors, which stops short of P2 */
+
+  n=0;
+  while((n < nMax) && (ulG != ulGap))
     {
-    iCount++;
-    iCount2++;
-    if(iCount >= iPrintCount)
+    iTest=(ulG >= 2*ulGap);
+    if(!iTest)iTest=uchSieve[(ulG - 2)/2];
+    if(iTest)pulPF[n++]=ulG;
+    ulG += 2;
+    }
+  if(n)
+    {
+    tnow=lfSeconds2();
+    Tgap=tnow - lft0 + 0.000500000000001;
+    sprintf(sz, "G=%7lu ...Checking P1 (%luD) + %lu...", ulGap, ulD1,
+      pulPF[0]);
+    sprintf(sz2, "%-62s (%.3fs)", sz, Tgap);
+    vProgress(sz2);
+    l=lProverTest(ppr, mpzP1, pulPF, n, piPF, NULL);
+    if(l==-2)  /* the prover failed; the chunk is tested here */
       {
-      tnow=lfSeconds2();
-      Tgap=tnow - lft0 + 0.000500000000001;
-      Ttotal=tnow - lfTstart;
-      if(Ttotal < Tgap)Ttotal=Tgap;
-      sprintf(sz, "G=%7lu ...Checking P1 (%luD) + %lu...", ulGap, ulD1, ulG);
-      sprintf(sz2, "%-62s (%.3fs)\n", sz, Tgap);
-      clrscr();
-      cputs(sz2);
-      iCount=0;
-      if((iBackup) && (iCount2 >= iBackupCount))
+      for(l=0; l < n; l++)
 	{
-	fpBackup=fopen(szBackupFile, "wt");
-	fprintf(fpBackup, "%lu  %lu  %lu  %.3f  %.3f\n",
-	  ulGap, ulP1Rem, ulG, Tgap, Ttotal);
-	fclose(fpBackup);
-	vFlush();
-	iCount2=0;
+	mpz_add_ui(mpz, mpzP1, pulPF[l]);
+	if(iPrP(mpz, ulMRReps, 2))break;
 	}
+      if(l==n)l=-1;
       }
-    fpLocal=fopen(szNFile, "wt");
-    gmp_fprintf(fpLocal, "%Zd\n", mpz);
-    fclose(fpLocal);
-#ifdef DEBUG
-    ulRmpz=mpz_fdiv_ui(mpz, 10000000UL);
-    printf("\n P1%lu    ulG=%lu    mpz%lu", ulRP1, ulG, ulRmpz);
-#endif
-    iStat=system(szPFGW1);
-    if(iStat != 1)
+    else if(l >= 0)  /* the prover's verdicts are confirmed */
       {
-      if(ulG==ulGap)
-	{
-	if(iMR2ThisGap)
-	  {
-	  if(iMillerRabin(mpzP2, 2))break;
-	  }
-	else
-	  {
-	  if(iPrP(mpzP2, ulMRReps, 2))break;
-	  }
-	}
-      else
+      for(; l < n; l++)
 	{
+	if(piPF[l] != 1)continue;
+	mpz_add_ui(mpz, mpzP1, pulPF[l]);
 	if(iPrP(mpz, ulMRReps, 2))break;
 	}
+      if(l==n)l=-1;
       }
+    if(l >= 0)
+      {
+      ulG=pulPF[l];
+      break;
+      }
+    tnow=lfSeconds2();
+    if(iBackup && (tnow - lfLastBackupTime >= lfBUI))
+      {
+      Tgap=tnow - lft0 + 0.000500000000001;
+      Ttotal=tnow - lfTstart;
+      if(Ttotal < Tgap)Ttotal=Tgap;
+      fpBackup=fopen(szBackupFile, "wt");
+      fprintf(fpBackup, "%lu  %lu  %lu  %.3f  %.3f\n",
+	ulGap, ulP1Rem, ulG, Tgap, Ttotal);
+      fclose(fpBackup);
+      vDurableFile(szBackupFile);
+      lfLastBackupTime=tnow;
+      }
+    if(nMax < (long)ulPFGWChunk)nMax=__MIN2(2*nMax, (long)ulPFGWChunk);
+    continue;
     }
-  mpz_add_ui(mpz, mpz, 2);
-  ulG += 2;
+
+  /* ulG==ulGap, every survivor before P2 being composite */
+
+  vPhaseMark(PH_INTERIOR);
+  if(iMR2ThisGap)
+    iStat=iMillerRabin(mpzP2, 2);
+  else
+    iStat=iPrP(mpzP2, ulMRReps, 2);
+  vPhaseMark(PH_P2);
+  if(iStat)break;
+  ulG += 2;  /* P2 composite: on to the first prime beyond it */
   }
+vPhaseMark(PH_INTERIOR);
+free(pulPF);
+free(piPF);
 
 remove(szBackupFile);
 if(!iCheckSieve)
@@ -1037,19 +1957,24 @@ if(!iCheckSieve)
   remove(szSieveFile);
   remove(szDivFile);
   }
-remove("pfgw.ini");
-remove("pfgw.log");
 remove(szNFile);
-clrscr();
-fpLocal=fopen(OUTFILE, "rt");
-if(fpLocal)
+remove(szOFile);
+vProgressClear();
+if(ppr->iKind==PROVER_BATCH)  /* PFGW clears the screen */
   {
-  while(1)
+  remove("pfgw.ini");
+  remove("pfgw.log");
+  iLogFlush(plsOut);
+  fpLocal=fopen(OUTFILE, "rt");
+  if(fpLocal)
     {
-    if(!fgets(sz, 80, fpLocal))break;
-    fprintf(stderr, "%s", sz);
+    while(1)
+      {
+      if(!fgets(sz, 80, fpLocal))break;
+      fprintf(stderr, "%s", sz);
+      }
+    fclose(fpLocal);
     }
-  fclose(fpLocal);
   }
 
 ulGBack=2;
@@ -1058,6 +1983,94 @@ iInsideGap=0;
 return(ulG);
 }
 /**********************************************************************/
+static void vProvers(char *szConfig)
+{
+/* Sets up the provers of the interior of a gap from the value of
+   CGLP4_PROVERS (NOTE (20)): entries "<digits>:<spec>", separated by
+   semicolons, each spec as read by pProverNew. */
+
+char *szCopy, *pch, *pchNext, *ep;
+unsigned long ul;
+
+szCopy=(char *)malloc(strlen(szConfig) + 1);
+if(!szCopy)
+  {
+  fprintf(stderr, "\n ERROR: Unable to allocate CGLP4_PROVERS.\n");
+  exit(EXIT_FAILURE);
+  }
+strcpy(szCopy, szConfig);
+for(pch=szCopy; pch; pch=pchNext)
+  {
+  pchNext=strchr(pch, ';');
+  if(pchNext)*pchNext++=0;
+  while(*pch==' ')pch++;
+  if(!*pch)continue;
+  ul=strtoul(pch, &ep, 10);
+  if((ep==pch) || (*ep != ':') || (nProvers==PROVERS_MAX)
+    || !(pprTab[nProvers]=pProverNew(ep + 1)))
+    {
+    fprintf(stderr,
+      "\n ERROR: Invalid or unsupported CGLP4_PROVERS entry \"%s\".\n",
+      pch);
+    exit(EXIT_FAILURE);
+    }
+  ulProverMin[nProvers++]=ul;
+  }
+free(szCopy);
+
+return;
+}
+/**********************************************************************/
+static struct __prover *pProverFor(unsigned long ulDigits)
+{
+/* The prover of the interior of a gap of ulDigits digits: that of the
+   provers entry with the greatest threshold <= ulDigits (the later of
+   equal ones), passing over any which has failed. NULL stands for
+   GMP, tested in place by mpz_gap. */
+
+struct __prover *ppr=NULL;
+unsigned long ulMin=0;
+int i;
+
+for(i=0; i < nProvers; i++)
+  {
+  if((ulProverMin[i] > ulDigits) || pprTab[i]->iFailed)continue;
+  if(ppr && (ulProverMin[i] < ulMin))continue;
+  ppr=pprTab[i];
+  ulMin=ulProverMin[i];
+  }
+if(ppr && (ppr->iKind==PROVER_GMP))ppr=NULL;
+
+return(ppr);
+}
+/**********************************************************************/
+static int iOnPath(char *szName, char *szPath)
+{
+/* Looks for the executable szName in the directories of PATH; if
+   found, its full name is copied to szPath (of at least 256 bytes)
+   and 1 is returned, else 0. */
+
+char *pch, *pchEnd;
+size_t n;
+
+pch=getenv("PATH");
+if(!pch)return(0);
+while(*pch)
+  {
+  pchEnd=strchr(pch, ':');
+  if(!pchEnd)pchEnd=pch + strlen(pch);
+  n=pchEnd - pch;
+  if(n && (n + strlen(szName) + 2 <= 256))
+    {
+    sprintf(szPath, "%.*s/%s", (int)n, pch, szName);
+    if(__lRFile(szPath) > 0)return(1);
+    }
+  pch=*pchEnd ? pchEnd + 1 : pchEnd;
+  }
+
+return(0);
+}
+/**********************************************************************/
 static void vSieve2(void)
 {
 /* Sieves the interior of the gap by finding which members are multiples
@@ -1076,6 +2089,26 @@ unsigned long ulMaxDiv, ulRem, ulDiv, ulOffset, ul, ul2, ul3,
   ulUnfactored, ulBase;
 double lfCheckSum, lfCheckSum2, lft0Sieve, lfSqrt;
 
+/* Maximum sieve divisor is chosen based on the number of decimal digits
+   in P1, and reflects empirical data. The bound is
+   recorded in ulSieveDiv (2 if there is no sieving), for the P-1 cost
+   model in mpz_gap. */
+
+ulMaxDiv=65519UL;  /* default value */
+if(ulD1 >=   500)ulMaxDiv=1e6;
+if(ulD1 >=  1500)ulMaxDiv=5e6;
+if(ulD1 >=  5000)ulMaxDiv=20e6;
+if(ulD1 >= 10000)ulMaxDiv=100e6;
+if(ulD1 >= 18000)ulMaxDiv=4294967291UL;
+
+if(ulD1 < 21)
+  {
+  lfSqrt=sqrt(mpz_get_d(mpzP1) + 2.0*ulGap);
+  if(ulMaxDiv > lfSqrt)ulMaxDiv=ceil(lfSqrt);
+  }
+
+ulSieveDiv=(ulD1 < 3) ? 2 : ulMaxDiv;
+
 fpSieve=fopen(szSieveFile, "rt");
 if(fpSieve)
   {
@@ -1113,22 +2146,6 @@ if(ulD1 < 3)return;  /* Don't sieve very small gaps or intervals */
 
 lft0Sieve=lfSeconds2();
 
-/* Maximum sieve divisor is chosen based on the number of decimal digits
-   in P1, and reflects empirical data. */
-
-ulMaxDiv=65519UL;  /* default value */
-if(ulD1 >=   500)ulMaxDiv=1e6;
-if(ulD1 >=  1500)ulMaxDiv=5e6;
-if(ulD1 >=  5000)ulMaxDiv=20e6;
-if(ulD1 >= 10000)ulMaxDiv=100e6;
-if(ulD1 >= 18000)ulMaxDiv=4294967291UL;
-
-if(ulD1 < 21)
-  {
-  lfSqrt=sqrt(mpz_get_d(mpzP1) + 2.0*ulGap);
-  if(ulMaxDiv > lfSqrt)ulMaxDiv=ceil(lfSqrt);
-  }
-
 /* Now sieve the interval from P1+2 to P1+2*ulGap=P2+ulGap. A ulGap
    length overflow buffer is created, in case P2 and all integers in
    P1 < n < P2 are composite and the gap is larger than advertised.
@@ -1273,7 +2290,7 @@ if(iBackup)
   fprintf(fpSieve, "%lu  %lu  %.0f\n", ulGap, ulP1Rem, lfCheckSum);
   for(ul=0; ul < ulGap; ul++)if(uchSieve[ul])fprintf(fpSieve, "%lu\n",
     2*ul + 2);
-  fclose(fpSieve); vFlush();
+  fclose(fpSieve); vDurableFile(szSieveFile);
   }
 
 return;
@@ -1310,12 +2327,17 @@ printf("\n See <http://www.trnicely.net/gaps/gaplist.html> for additional");
 printf("\n details and examples.");
 printf("\n");
 printf("\n The (exported) environmental (shell) variables MRREPS,");
-printf("\n CGLP4_BACKUP, CGLP4BUI, and INTERIOR may also be");
-printf("\n used (through SET, export, declare -x, setenv, unset, etc.) to");
-printf("\n modify execution; see the source code cglp4.c for details.");
+printf("\n CGLP4_BACKUP, CGLP4BUI, CGLP4_THREADS, CGLP4_PM1, CGLP4_INDEX,");
+printf("\n CGLP4_READER, CGLP4_FLUSH, CGLP4_DURABLE, CGLP4_RESULTS,");
+printf("\n CGLP4_PFGW, CGLP4_PFGW_CHUNK, CGLP4_PROVERS, and INTERIOR");
+printf("\n may also be used (through SET, export, declare -x, setenv,");
+printf("\n unset, etc.) to modify execution;");
+printf("\n see the source code cglp4.c for details.");
+printf("\n The e option exports the selected gaps as the binary gap list");
+printf("\n nocheck.gpb, which may in turn be used as infile.");
 printf("\n");
 printf(
-  "\n SYNTAX: cglp4 infile [x|m|M|z|b] [mingap maxgap] [mindig maxdig] [n]");
+  "\n SYNTAX: cglp4 infile [x|m|M|z|e|b] [mingap maxgap] [mindig maxdig] [n]");
 exit(EXIT_FAILURE);
 }
 /**********************************************************************/
@@ -137,7 +137,8 @@ fflush(NULL);
 
 #elif defined(__LINUX__)
 
-system("tput el"); fflush(NULL);
+fflush(NULL);
+fputs("\033[K", stdout); fflush(stdout);  /* as tput el, without a fork */
 
 #endif
 
@@ -171,8 +172,8 @@ __gotoxy(1, 1);
 
 #elif defined(__LINUX__)
 
-system("clear");
 fflush(NULL);
+fputs("\033[H\033[2J", stdout); fflush(stdout);  /* as clear */
 
 #endif
 
@@ -221,7 +222,7 @@ __gotoxy(tiGlobal.curx, tiGlobal.cury);
 
 #elif defined(__LINUX__)
 
-system("tput dl1");
+fputs("\033[M", stdout);  /* as tput dl1 */
 
 #endif
 
@@ -453,9 +454,9 @@ fflush(NULL);
 
 #elif defined(__LINUX__)
 
-sprintf(sz, "tput cup %d %d", iRow, iCol);  /* tput expects row first */
-system(sz);
+sprintf(sz, "\033[%d;%dH", iRow + 1, iCol + 1);  /* as tput cup */
 fflush(NULL);
+fputs(sz, stdout); fflush(stdout);
 
 #endif
 
@@ -509,7 +510,7 @@ __gotoxy(tiGlobal.curx, tiGlobal.cury);
 
 #elif defined(__LINUX__)
 
-system("tput il1");
+fputs("\033[L", stdout);  /* as tput il1 */
 
 #endif
 
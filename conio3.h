@@ -275,7 +275,10 @@ int  __wherey(void);
 
 /* clrscr in Cygwin must be kludged; use the conio3 version instead */
 
-#if defined(__MINGW__) || defined(__LINUX__)
+#if defined(__LINUX__)  /* ANSI, as clear would write it */
+  #undef  clrscr
+  #define clrscr() {fputs("\033[H\033[2J", stdout); fflush(stdout);}
+#elif defined(__MINGW__)
   #undef  clrscr
   #define clrscr() {system("clear");}
 #elif defined(__DMC__)
@@ -0,0 +1,128 @@
+/* contbench.c
+ *
+ * Times the assembly of long continued gap records by the readers of
+ * trn.c, iGetGapRecExt (stdio) and iGetGapRecView (a gap list opened by
+ * pGapListOpen, mapped where __MMAP__ is defined). A gap6 record with
+ * a P1 of the given number of decimal digits is continued by
+ * vGapContExt (200 digits to a line) and written the given number of
+ * times to the file contbench.dat, which is then read back by each
+ * reader in turn; every record read must match the original exactly.
+ * No primality tests are done.
+ *
+ * Compile with a command such as
+ *
+ *   gcc -O2 contbench.c trn.c [conio3.c] -lm -lgmp -lpthread -D__NOMPFR__
+ *
+ * SYNTAX:
+ *
+ * contbench [digits [records]]
+ *
+ * where digits (default 300000, at most __MAX_DIGITS__ - 1000) is the
+ * length of P1 and records (default 2) the number of copies. The
+ * elapsed time of each reader is printed, with "OK" or "MISMATCH".
+ * To compare two versions of trn.c, build contbench against each
+ * (e.g. from "git show <commit>:trn.c") and run both with the same
+ * arguments.
+ *
+ */
+
+#if !defined(_TRN_H_)
+  #include "trn.h"
+#endif
+
+#define BENCHFILE "contbench.dat"
+
+/**********************************************************************/
+/**********************************************************************/
+int main(int argc, char *argv[])
+{
+char *szGapRec, *szContRec, *szRec, *pchRec;
+long lDigits=300000L, lRecs=2, l, n;
+int iOK;
+double lft;
+FILE *fp;
+struct __gaplist *pgl;
+
+if(argc > 1)lDigits=atol(argv[1]);
+if(argc > 2)lRecs=atol(argv[2]);
+if((lDigits < 1) || (lDigits > (long)__MAX_DIGITS__ - 1000) || (lRecs < 1))
+  {
+  fprintf(stderr, "\n SYNTAX: contbench [digits [records]]\n");
+  exit(EXIT_FAILURE);
+  }
+
+szGapRec=(char *)malloc(lDigits + 64);
+szContRec=(char *)malloc(lDigits + 42*(lDigits/200 + 2) + 64);
+szRec=(char *)malloc(__MAX_DIGITS__ + 64);
+if(!szGapRec || !szContRec || !szRec)
+  {
+  fprintf(stderr, "\n ***FATAL ERROR: malloc failed in contbench.\n");
+  exit(EXIT_FAILURE);
+  }
+
+/* The record: a gap6 header of 40 columns, then the digits of P1 */
+
+sprintf(szGapRec, "%6ld  C?C NicelyHD 2002  %5.2f%6ld  ",
+  2*(lDigits/10 + 1), 1.0, lDigits);
+n=strlen(szGapRec);
+for(l=0; l < lDigits; l++)szGapRec[n + l]='1' + (l%9);
+szGapRec[n + lDigits]=0;
+vGapContExt(szContRec, szGapRec);
+if(!szContRec[0])
+  {
+  fprintf(stderr, "\n ***FATAL ERROR: vGapContExt rejected the record.\n");
+  exit(EXIT_FAILURE);
+  }
+
+fp=fopen(BENCHFILE, "w");
+if(!fp)
+  {
+  fprintf(stderr, "\n ***FATAL ERROR: Unable to create %s.\n", BENCHFILE);
+  exit(EXIT_FAILURE);
+  }
+for(l=0; l < lRecs; l++)fprintf(fp, "%s\n", szContRec);
+fclose(fp);
+printf("\n %ld records of %ld digits (%ld lines each) in %s\n",
+  lRecs, lDigits, (lDigits + 199)/200, BENCHFILE);
+
+/* iGetGapRecExt */
+
+iOK=1;
+n=0;
+lft=lfSeconds2();
+fp=fopen(BENCHFILE, "r");
+while(iGetGapRecExt(szRec, fp))
+  {
+  n++;
+  if(strcmp(szRec, szGapRec))iOK=0;
+  }
+fclose(fp);
+lft=lfSeconds2() - lft;
+printf(" iGetGapRecExt : %ld records  %.4f s  %s\n", n, lft,
+  (iOK && (n==lRecs)) ? "OK" : "MISMATCH");
+
+/* iGetGapRecView */
+
+iOK=1;
+n=0;
+lft=lfSeconds2();
+pgl=pGapListOpen(BENCHFILE);
+if(pgl)
+  {
+  while(iGetGapRecView(pgl, &pchRec) >= 0)
+    {
+    n++;
+    if(strcmp(pchRec, szGapRec))iOK=0;
+    }
+  vGapListClose(pgl);
+  }
+lft=lfSeconds2() - lft;
+printf(" iGetGapRecView: %ld records  %.4f s  %s\n", n, lft,
+  (iOK && (n==lRecs)) ? "OK" : "MISMATCH");
+
+free(szGapRec);
+free(szContRec);
+free(szRec);
+return(EXIT_SUCCESS);
+}
+/**********************************************************************/
@@ -74,6 +74,11 @@
 #define M_EPSILON1 LDBL_EPSILON
 
 static uint64_t seed64(void);  /* for internal use only */
+#ifdef __GMP__
+static int iMillerScreen(mpz_t mpzN, struct __mpz_modctx *pmc);
+static int iPrPParallel(mpz_t mpzN, unsigned long ulNMR,
+  struct __mpz_modctx *pmc);
+#endif
 
 /* The following external variables may be accessed from linked codes
    by means of global "extern" declarations. For the arrays, use,
@@ -1155,6 +1160,45 @@ free(pch);
 return(ld);
 }
 /**********************************************************************/
+#define NDIGITS_CACHE 8  /* cached powers of ten, 10^k in slot k%8 */
+/**********************************************************************/
+unsigned long __mpz_ndigits10(mpz_t mpz)
+{
+/* Returns the exact number of decimal digits in |mpz| (1 for zero),
+   without a radix conversion. mpz_sizeinbase(mpz, 10) is either exact
+   or one too large; the choice is made by comparing |mpz| with
+   10^(k-1), k being that estimate. The powers of ten are cached, since
+   consecutive calls (the records of a gap list) tend to have the same
+   size, so that the usual cost is that of a single comparison. Not
+   thread-safe. */
+
+static mpz_t ampzPow[NDIGITS_CACHE];
+static unsigned long aulPow[NDIGITS_CACHE];
+static int iInit=0;
+unsigned long ulK;
+int i;
+
+ulK=mpz_sizeinbase(mpz, 10);
+if(ulK < 2)return(1);
+if(!iInit)
+  {
+  for(i=0; i < NDIGITS_CACHE; i++)
+    {
+    mpz_init_set_ui(ampzPow[i], 1);
+    aulPow[i]=0;
+    }
+  iInit=1;
+  }
+i=(ulK - 1)%NDIGITS_CACHE;
+if(aulPow[i] != ulK - 1)
+  {
+  mpz_ui_pow_ui(ampzPow[i], 10, ulK - 1);
+  aulPow[i]=ulK - 1;
+  }
+
+return((mpz_cmpabs(mpz, ampzPow[i]) < 0) ? ulK - 1 : ulK);
+}
+/**********************************************************************/
 long double __mpz_logl(mpz_t mpz)
 {
 return(__mpz_log10l(mpz)*M_LN10);
@@ -2312,40 +2356,298 @@ free(uchPrime2);
 return;
 }
 /**********************************************************************/
-int iIsPrime32(unsigned long ulN)
+/*     Strong Baillie-PSW test for 64-bit N in native arithmetic      */
+/**********************************************************************/
+static uint64_t ullMulHi64(uint64_t ull1, uint64_t ull2)
+{
+/* High 64 bits of the 128-bit product ull1*ull2. */
+
+#ifdef __SIZEOF_INT128__
+return((uint64_t)(((unsigned __int128)ull1*ull2) >> 64));
+#else
+uint64_t ullL1, ullH1, ullL2, ullH2, ullLL, ullLH, ullHL, ullHH, ullMid;
+
+ullL1=ull1 & UINT32_MAX; ullH1=ull1 >> 32;
+ullL2=ull2 & UINT32_MAX; ullH2=ull2 >> 32;
+ullLL=ullL1*ullL2;
+ullLH=ullL1*ullH2;
+ullHL=ullH1*ullL2;
+ullHH=ullH1*ullH2;
+ullMid=(ullLL >> 32) + (ullLH & UINT32_MAX) + (ullHL & UINT32_MAX);
+return(ullHH + (ullLH >> 32) + (ullHL >> 32) + (ullMid >> 32));
+#endif
+}
+/**********************************************************************/
+static uint64_t ullMontMul(uint64_t ullA, uint64_t ullB, uint64_t ullN,
+  uint64_t ullNinv)
 {
-/* Returns 1 if ulN is prime, zero otherwise. No sieving is used. The
-   routine simply checks for prime divisors up to the sqrt of ulN. */
+/* Montgomery product A*B/2^64 mod N, for odd N and A, B < N; ullNinv
+   is 1/N mod 2^64. The subtractive form of REDC is used, so that no
+   intermediate value exceeds 128 bits even for N > 2^63. */
 
-unsigned long ulSqrtN, ul=2, ulDiv;
+uint64_t ullLo, ullHi, ullM, ullMNHi;
 
-if((ulN < 3) || ((ulN & 1)==0))return(ulN==2 ? 1 : 0);
+ullLo=ullA*ullB;
+ullHi=ullMulHi64(ullA, ullB);
+ullM=ullLo*ullNinv;
+ullMNHi=ullMulHi64(ullM, ullN);
+return(ullHi >= ullMNHi ? ullHi - ullMNHi : ullHi - ullMNHi + ullN);
+}
+/**********************************************************************/
+static uint64_t ullAddMod(uint64_t ullA, uint64_t ullB, uint64_t ullN)
+{
+uint64_t ull=ullA + ullB;
 
-if(!iPrime16Initialized)vGenPrimes16();
-ulSqrtN=ulSqrt(ulN);
+if((ull < ullA) || (ull >= ullN))ull -= ullN;
+return(ull);
+}
+/**********************************************************************/
+static uint64_t ullSubMod(uint64_t ullA, uint64_t ullB, uint64_t ullN)
+{
+return(ullA >= ullB ? ullA - ullB : ullA - ullB + ullN);
+}
+/**********************************************************************/
+static uint64_t ullHalfMod(uint64_t ullA, uint64_t ullN)
+{
+/* A/2 mod N, N odd; (A + N)/2 is formed without overflow. */
+
+if(ullA & 1)return((ullA >> 1) + (ullN >> 1) + 1);
+return(ullA >> 1);
+}
+/**********************************************************************/
+static int iJacobi64(long lD, uint64_t ullN)
+{
+/* Jacobi symbol (D/N), N odd and positive. */
+
+uint64_t ullA, ull;
+int iJ=1;
+
+if(lD < 0)
+  {
+  ullA=(uint64_t)(-lD);
+  if((ullN & 3)==3)iJ=-iJ;  /* (-1/N) */
+  }
+else
+  ullA=(uint64_t)lD;
+ullA %= ullN;
+while(ullA)
+  {
+  while((ullA & 1)==0)
+    {
+    ullA >>= 1;
+    if(((ullN & 7)==3) || ((ullN & 7)==5))iJ=-iJ;
+    }
+  ull=ullA; ullA=ullN; ullN=ull;
+  if(((ullA & 3)==3) && ((ullN & 3)==3))iJ=-iJ;
+  ullA %= ullN;
+  }
+return(ullN==1 ? iJ : 0);
+}
+/**********************************************************************/
+int iBPSW64(uint64_t ullN)
+{
+/* Strong Baillie-PSW test (Miller's test with base 2, followed by the
+   strong Lucas-Selfridge test) for 64-bit N, entirely in native
+   Montgomery arithmetic; see iBPSW for the mpz version and the
+   background. Since no BPSW pseudoprime exists below 2^64 (Feitsma
+   and Gilchrist), the result is deterministic: returns 1 if N is
+   prime, 0 otherwise. Only N < 3, even N, and perfect squares are
+   screened; small prime divisors are the caller's business. */
+
+uint64_t ullNinv, ullOne, ullR2, ullD, ullX, ullMOne, ull, ullU, ullV,
+         ullQk, ullDm, ullQm, ullT;
+unsigned long s, r, ulSqrtN;
+long lD;
+int i, j;
+
+if((ullN < 3) || ((ullN & 1)==0))return(ullN==2 ? 1 : 0);
+
+/* Montgomery constants: 1/N mod 2^64 (Newton), 2^64 mod N, and
+   2^128 mod N. */
+
+ullNinv=ullN;  /* correct to 3 bits, since N*N == 1 (mod 8) */
+for(i=0; i < 5; i++)ullNinv *= 2 - ullN*ullNinv;
+ullOne=(0 - ullN) % ullN;
+ullR2=ullOne;
+for(i=0; i < 64; i++)ullR2=ullAddMod(ullR2, ullR2, ullN);
+ullMOne=ullN - ullOne;  /* -1 in Montgomery form */
+
+/* Miller's test with base 2; N - 1 = (2^s)*d, d odd. */
+
+ullD=ullN - 1;
+for(s=0; (ullD & 1)==0; s++)ullD >>= 1;
+ullX=ullOne;
+ull=ullAddMod(ullOne, ullOne, ullN);  /* 2 in Montgomery form */
+for(j=63; j >= 0; j--)  /* left-to-right exponentiation, 2^d */
+  {
+  ullX=ullMontMul(ullX, ullX, ullN, ullNinv);
+  if((ullD >> j) & 1)ullX=ullMontMul(ullX, ull, ullN, ullNinv);
+  }
+if((ullX != ullOne) && (ullX != ullMOne))
+  {
+  for(r=1; r < s; r++)
+    {
+    ullX=ullMontMul(ullX, ullX, ullN, ullNinv);
+    if(ullX==ullMOne)break;
+    if(ullX==ullOne)return(0);
+    }
+  if(r >= s)return(0);
+  }
+
+/* Strong Lucas-Selfridge test. Perfect squares have no D with
+   Jacobi(D,N) = -1, and must be screened out first. */
 
+ulSqrtN=ulSqrt(ullN);
+if((uint64_t)ulSqrtN*ulSqrtN==ullN)return(0);
+lD=5;
 while(1)
   {
-  ulDiv=ulPrime16[ul++];
-  if(ulDiv > ulSqrtN)return(1);
-  if(ulN%ulDiv==0)return(0);
+  i=iJacobi64(lD, ullN);
+  if(i==-1)break;
+  if((i==0) && ((uint64_t)(lD < 0 ? -lD : lD) % ullN))return(0);
+  lD=(lD > 0) ? -(lD + 2) : -lD + 2;
+  }
+
+/* Selfridge's parameters P=1, Q=(1 - D)/4, in Montgomery form. N + 1 =
+   (2^s)*d, d odd. Left-to-right over the bits of d, with k -> 2k by
+   U_2k=U_k*V_k, V_2k=V_k^2 - 2Q^k, and k -> k+1 by U_(k+1)=(U_k + V_k)/2,
+   V_(k+1)=(D*U_k + V_k)/2, starting from U_1=1, V_1=P=1. */
+
+ull=(uint64_t)(lD < 0 ? -lD : lD) % ullN;
+ullDm=ullMontMul(ull, ullR2, ullN, ullNinv);
+if(lD < 0)ullDm=ullSubMod(0, ullDm, ullN);
+lD=(1 - lD)/4;  /* now Q */
+ull=(uint64_t)(lD < 0 ? -lD : lD) % ullN;
+ullQm=ullMontMul(ull, ullR2, ullN, ullNinv);
+if(lD < 0)ullQm=ullSubMod(0, ullQm, ullN);
+
+ullD=ullN + 1;  /* 2^64 - 1 (the only overflow) fails Miller's test */
+for(s=0; (ullD & 1)==0; s++)ullD >>= 1;
+for(j=63; ((ullD >> j) & 1)==0; j--);
+ullU=ullOne;
+ullV=ullOne;
+ullQk=ullQm;
+for(j--; j >= 0; j--)
+  {
+  ullU=ullMontMul(ullU, ullV, ullN, ullNinv);
+  ullV=ullSubMod(ullMontMul(ullV, ullV, ullN, ullNinv),
+    ullAddMod(ullQk, ullQk, ullN), ullN);
+  ullQk=ullMontMul(ullQk, ullQk, ullN, ullNinv);
+  if((ullD >> j) & 1)
+    {
+    ullT=ullHalfMod(ullAddMod(ullU, ullV, ullN), ullN);
+    ullV=ullHalfMod(ullAddMod(ullMontMul(ullDm, ullU, ullN, ullNinv),
+      ullV, ullN), ullN);
+    ullU=ullT;
+    ullQk=ullMontMul(ullQk, ullQm, ullN, ullNinv);
+    }
+  }
+if((ullU==0) || (ullV==0))return(1);
+for(r=1; r < s; r++)
+  {
+  ullV=ullSubMod(ullMontMul(ullV, ullV, ullN, ullNinv),
+    ullAddMod(ullQk, ullQk, ullN), ullN);
+  if(ullV==0)return(1);
+  ullQk=ullMontMul(ullQk, ullQk, ullN, ullNinv);
   }
+
+return(0);
 }
 /**********************************************************************/
-#ifdef __GMP__
+static int iMiller32(uint32_t u32N, uint32_t u32B)
+{
+/* Miller's (strong probable prime) test of the odd u32N > 1 to base
+   B, in native arithmetic; returns 1 if u32N passes. */
+
+uint64_t ullX, ullB;
+uint32_t u32D;
+int iS;
+
+ullB=u32B%u32N;
+if(ullB==0)return(1);
+u32D=u32N - 1;
+for(iS=0; (u32D & 1)==0; iS++)u32D >>= 1;
+ullX=1;
+while(u32D)
+  {
+  if(u32D & 1)ullX=ullX*ullB%u32N;
+  ullB=ullB*ullB%u32N;
+  u32D >>= 1;
+  }
+if((ullX==1) || (ullX==u32N - 1))return(1);
+while(--iS > 0)
+  {
+  ullX=ullX*ullX%u32N;
+  if(ullX==u32N - 1)return(1);
+  }
+
+return(0);
+}
+/**********************************************************************/
+int iIsPrime32(unsigned long ulN)
+{
+/* Returns 1 if ulN is prime, zero otherwise. No sieving or table of
+   primes is used. After division by 2, 3, 5, and 7 (which settles
+   ulN < 121), a single Miller's test decides, its base being looked up
+   in a table indexed by a hash of ulN, after the method of M. Forisek
+   and J. Jancina, "Fast primality testing for integers that fit into a
+   machine word" (2015). The hash is not their FJ32_256 hash, which
+   works in 32-bit arithmetic: here the products are taken modulo 2^64,
+   which gives other values, and the table belongs to this hash (it is
+   not the one published with FJ32_256, and may not be used with it).
+   The table has been checked exhaustively: the test is exact for all
+   N < 2^32. Larger arguments (64-bit longs) are passed to iBPSW64. */
+
+static const unsigned short ausBase[256]={
+  15591, 2018, 166, 7429, 8064, 16045, 10503, 4399, 1949, 1295, 2776,
+  3620, 560, 3128, 5212, 2657, 2300, 2021, 4652, 1471, 9336, 4018,
+  2398, 20462, 10277, 8028, 2213, 6219, 620, 3763, 4852, 5012, 3185,
+  1333, 6227, 5298, 1074, 2391, 5113, 7061, 803, 1269, 3875, 422, 751,
+  580, 4729, 10239, 746, 2951, 556, 2206, 3778, 481, 1522, 3476, 481,
+  2487, 3266, 5633, 488, 3373, 6441, 3344, 17, 15105, 1490, 4154, 2036,
+  1882, 1813, 467, 3307, 14042, 6371, 658, 1005, 903, 737, 1887, 7447,
+  1888, 2848, 1784, 7559, 3400, 951, 13969, 4304, 177, 41, 19875, 3110,
+  13221, 8726, 571, 7043, 6943, 1199, 352, 6435, 165, 1169, 3315, 978,
+  233, 3003, 2562, 2994, 10587, 10030, 2377, 1902, 5354, 4447, 1555,
+  263, 27027, 2283, 305, 669, 1912, 601, 6186, 429, 1930, 14873, 1784,
+  1661, 524, 3577, 236, 2360, 6146, 2850, 55637, 1753, 4178, 8466, 222,
+  2579, 2743, 2031, 2226, 2276, 374, 2132, 813, 23788, 1610, 4422,
+  5159, 1725, 3597, 3366, 14336, 579, 165, 1375, 10018, 12616, 9816,
+  1371, 536, 1867, 10864, 857, 2206, 5788, 434, 8085, 17618, 727, 3639,
+  1595, 4944, 2129, 2029, 8195, 8344, 6232, 9183, 8126, 1870, 3296,
+  7455, 8947, 25017, 541, 19115, 368, 566, 5674, 411, 522, 1027, 8215,
+  2050, 6544, 10049, 614, 774, 2333, 3007, 35201, 4706, 1152, 1785,
+  1028, 1540, 3743, 493, 4474, 2521, 26845, 8354, 864, 18915, 5465,
+  2447, 42, 4511, 1660, 166, 1249, 6259, 2553, 304, 272, 7286, 73,
+  6554, 899, 2816, 5197, 13330, 7054, 2818, 3199, 811, 922, 350, 7514,
+  4452, 3449, 2663, 4708, 418, 1621, 1171, 3471, 88, 11345, 412, 1559,
+  194};
+uint64_t ullH;
+
+if(ulN > 4294967295UL)return(iBPSW64(ulN));
+if(ulN < 11)return((ulN==2) || (ulN==3) || (ulN==5) || (ulN==7));
+if((ulN%2==0) || (ulN%3==0) || (ulN%5==0) || (ulN%7==0))return(0);
+if(ulN < 121)return(1);
+
+ullH=ulN;
+ullH=((ullH >> 16) ^ ullH)*0x45d9f3b;
+ullH=((ullH >> 16) ^ ullH)*0x45d9f3b;
+ullH=((ullH >> 16) ^ ullH) & 255;
+
+return(iMiller32((uint32_t)ulN, ausBase[ullH]));
+}
 /**********************************************************************/
 int iIsPrime64(uint64_t ullN, unsigned long ulMaxDivisor)
 {
 /* Returns 1 if ullN is prime, zero otherwise. No sieving is used.
    The routine checks for prime divisors up to the smaller of the
    sqrt of ullN or ulMaxDivisor. If no prime divisor is found, and
-   N > ulMaxDivisor^2 exceeds 2^32, the strong BPSW primality test
-   is invoked. If 0 or 1 is specified for ulMaxDivisor, a default
+   N > ulMaxDivisor^2, the strong BPSW primality test is invoked
+   (iBPSW64, in native 64-bit arithmetic; it is deterministic for
+   all 64-bit N). If 0 or 1 is specified for ulMaxDivisor, a default
    value of 1000 is used. */
 
-static long        iFirst=1;
 unsigned long	   ulSqrtN, ul=2, ulDiv;
-mpz_t              mpzN;
 
 if((ullN < 3) || ((ullN & 1)==0))return(ullN==2 ? 1 : 0);
 if(!iPrime16Initialized)vGenPrimes16();
@@ -2365,13 +2667,322 @@ while(1)
 /* If there are no small prime divisors, we use the strong BPSW test
    for primality. */
 
-if(iFirst)
+return(iBPSW64(ullN));
+}
+/**********************************************************************/
+#ifdef __GMP__
+/**********************************************************************/
+#define MODCTX_BARRETT_BITS 6144UL  /* below this mpz_mod is faster */
+#define MODCTX_SPECIAL_BITS 768UL    /* smallest special N = 2^n + c */
+/**********************************************************************/
+void __mpz_modctx_init(struct __mpz_modctx *pmc, mpz_t mpzN)
+{
+/* Set up a modulus context for the odd modulus N > 2, for use by
+   __mpz_mod_ctx and the ...Ctx primality tests. The context must be
+   released by __mpz_modctx_clear. N < 3 and even N are accepted (the
+   tests screen them out before any reduction), but no Barrett
+   reciprocal is computed for them.
+
+   If N = 2^n + c, with |c| <= LONG_MAX and N of at least
+   MODCTX_SPECIAL_BITS binary digits, reductions are carried out using
+   2^n == -c (mod N).
+   Otherwise, Barrett reduction is used if N has at least
+   MODCTX_BARRETT_BITS binary digits; below that, the GMP division in
+   mpz_mod is faster than the two multiplications of the Barrett step.
+   The Barrett reciprocal (a full division) is computed by the first
+   reduction that needs it, not here: many contexts never reduce
+   through __mpz_mod_ctx, as when the test is settled by screening or
+   the powering is left to mpz_powm. */
+
+mpz_init_set(pmc->mpzN, mpzN);
+mpz_init(pmc->mpzMu);
+mpz_init(pmc->mpzQ);
+mpz_init(pmc->mpzNm1);
+mpz_init(pmc->mpzd);
+pmc->ulBits=mpz_sizeinbase(mpzN, 2);
+pmc->iScreen=-1;
+pmc->piAbort=NULL;
+pmc->iBarrett=0;
+pmc->iSpecial=0;
+pmc->ulExp2=0;
+pmc->lC=0;
+pmc->ulS=0;
+if((mpz_cmp_si(mpzN, 2) <= 0) || mpz_even_p(mpzN))return;
+
+/* N - 1 = (2^s)*d, d odd */
+
+mpz_sub_ui(pmc->mpzNm1, mpzN, 1);
+pmc->ulS=mpz_scan1(pmc->mpzNm1, 0);
+mpz_tdiv_q_2exp(pmc->mpzd, pmc->mpzNm1, pmc->ulS);
+
+/* Special form N = 2^(k-1) + c, c > 0, or N = 2^k + c, c < 0 */
+
+if(pmc->ulBits >= MODCTX_SPECIAL_BITS)
   {
-  mpz_init2(mpzN, 512);
-  iFirst=0;
+  mpz_set_ui(pmc->mpzQ, 0);
+  mpz_setbit(pmc->mpzQ, pmc->ulBits - 1);
+  mpz_sub(pmc->mpzQ, mpzN, pmc->mpzQ);
+  if(mpz_cmp_ui(pmc->mpzQ, LONG_MAX) <= 0)
+    {
+    pmc->iSpecial=1;
+    pmc->ulExp2=pmc->ulBits - 1;
+    pmc->lC=mpz_get_ui(pmc->mpzQ);
+    return;
+    }
+  mpz_set_ui(pmc->mpzQ, 0);
+  mpz_setbit(pmc->mpzQ, pmc->ulBits);
+  mpz_sub(pmc->mpzQ, pmc->mpzQ, mpzN);
+  if(mpz_cmp_ui(pmc->mpzQ, LONG_MAX) <= 0)
+    {
+    pmc->iSpecial=1;
+    pmc->ulExp2=pmc->ulBits;
+    pmc->lC=-(long)mpz_get_ui(pmc->mpzQ);
+    return;
+    }
+  }
+
+if(pmc->ulBits < MODCTX_BARRETT_BITS)return;
+
+pmc->iBarrett=1;  /* mu is left 0 until needed */
+
+return;
+}
+/**********************************************************************/
+void __mpz_modctx_clear(struct __mpz_modctx *pmc)
+{
+mpz_clear(pmc->mpzN);
+mpz_clear(pmc->mpzMu);
+mpz_clear(pmc->mpzQ);
+mpz_clear(pmc->mpzNm1);
+mpz_clear(pmc->mpzd);
+return;
+}
+/**********************************************************************/
+void __mpz_mod_ctx(mpz_t mpzR, mpz_t mpzX, struct __mpz_modctx *pmc)
+{
+/* R = X mod N, 0 <= R < N, N being the modulus of the context. R and
+   X may be the same variable.
+
+   For special N = 2^n + c, X = H*2^n + L is replaced by L - c*H until
+   |X| < 2^(n+1), followed by at most a few additions or subtractions
+   of N. Barrett reduction is applied when the context provides it and
+   0 <= X < 4^k; otherwise mpz_mod is used. The Barrett quotient
+   estimate q = ((X >> (k-1))*mu) >> (k+1) is never too large, and is
+   at most two short, so that R = X - q*N needs at most two
+   corrections. */
+
+unsigned long ulK;
+
+if(pmc->iSpecial)
+  {
+  ulK=pmc->ulExp2;
+  if(mpzR != mpzX)mpz_set(mpzR, mpzX);
+  while(mpz_sizeinbase(mpzR, 2) > ulK + 1)
+    {
+    mpz_fdiv_q_2exp(pmc->mpzQ, mpzR, ulK);
+    mpz_fdiv_r_2exp(mpzR, mpzR, ulK);
+    if(pmc->lC > 0)
+      mpz_submul_ui(mpzR, pmc->mpzQ, pmc->lC);
+    else
+      mpz_addmul_ui(mpzR, pmc->mpzQ, -pmc->lC);
+    }
+  while(mpz_sgn(mpzR) < 0)mpz_add(mpzR, mpzR, pmc->mpzN);
+  while(mpz_cmp(mpzR, pmc->mpzN) >= 0)mpz_sub(mpzR, mpzR, pmc->mpzN);
+  return;
+  }
+
+if(!pmc->iBarrett || (mpz_sgn(mpzX) < 0)
+    || (mpz_sizeinbase(mpzX, 2) > 2*pmc->ulBits))
+  {
+  mpz_mod(mpzR, mpzX, pmc->mpzN);
+  return;
+  }
+
+ulK=pmc->ulBits;
+if(mpz_sgn(pmc->mpzMu)==0)  /* mu = floor(4^k/N), on first use */
+  {
+  mpz_setbit(pmc->mpzMu, 2*ulK);
+  mpz_tdiv_q(pmc->mpzMu, pmc->mpzMu, pmc->mpzN);
+  }
+mpz_tdiv_q_2exp(pmc->mpzQ, mpzX, ulK - 1);
+mpz_mul(pmc->mpzQ, pmc->mpzQ, pmc->mpzMu);
+mpz_tdiv_q_2exp(pmc->mpzQ, pmc->mpzQ, ulK + 1);
+if(mpzR != mpzX)mpz_set(mpzR, mpzX);
+mpz_submul(mpzR, pmc->mpzQ, pmc->mpzN);
+while(mpz_cmp(mpzR, pmc->mpzN) >= 0)mpz_sub(mpzR, mpzR, pmc->mpzN);
+
+return;
+}
+/**********************************************************************/
+void __mpz_powm_ctx(mpz_t mpzR, mpz_t mpzB, mpz_t mpzE,
+  struct __mpz_modctx *pmc)
+{
+/* R = B^E mod N, N being the modulus of the context. For special N
+   (see __mpz_modctx_init) and a single-limb base 1 < B < N, as in
+   Miller's and Fermat's tests, left-to-right binary exponentiation
+   with __mpz_mod_ctx is used; each step is then a squaring, a linear
+   time reduction, and possibly a single-limb multiply (a shift for
+   B=2), roughly three times faster than mpz_powm at 4000-100000 bits.
+   Otherwise, mpz_powm is called. R may not be the same variable as E. */
+
+unsigned long ulB;
+long j;
+
+if(!pmc->iSpecial || (mpzR==mpzE) || (mpz_sgn(mpzE) <= 0)
+    || (mpz_cmp_ui(mpzB, 2) < 0) || !mpz_fits_ulong_p(mpzB)
+    || (mpz_cmp(mpzB, pmc->mpzN) >= 0))
+  {
+  mpz_powm(mpzR, mpzB, mpzE, pmc->mpzN);
+  return;
+  }
+
+ulB=mpz_get_ui(mpzB);
+mpz_set_ui(mpzR, ulB);
+for(j=mpz_sizeinbase(mpzE, 2) - 2; j >= 0; j--)
+  {
+  mpz_mul(mpzR, mpzR, mpzR);
+  __mpz_mod_ctx(mpzR, mpzR, pmc);
+  if(mpz_tstbit(mpzE, j))
+    {
+    if(ulB==2)
+      {
+      mpz_mul_2exp(mpzR, mpzR, 1);
+      if(mpz_cmp(mpzR, pmc->mpzN) >= 0)mpz_sub(mpzR, mpzR, pmc->mpzN);
+      }
+    else
+      {
+      mpz_mul_ui(mpzR, mpzR, ulB);
+      __mpz_mod_ctx(mpzR, mpzR, pmc);
+      }
+    }
+  }
+
+return;
+}
+/**********************************************************************/
+#define PRP_PARALLEL_BITS 2048UL  /* smaller N are tested serially */
+/**********************************************************************/
+struct __prp_round
+  {
+  int iType;  /* 0 Miller, 1 strong Lucas-Selfridge, 2 extra strong Lucas */
+  long lB;    /* base */
+  };
+
+struct __prp_job
+  {
+  mpz_ptr mpzN;
+  struct __prp_round *pRound;
+  long lFirst;             /* index in pRound of task 0 */
+  int iAbort;              /* set by the first round proving N composite */
+  };
+/**********************************************************************/
+static int iAbortGet(int *piAbort)
+{
+/* *piAbort, which a round of iPrPParallel may set in another thread
+   (see vAbortSet); an atomic load under __PTHREADS__. */
+
+#ifdef __PTHREADS__
+return(__atomic_load_n(piAbort, __ATOMIC_RELAXED));
+#else
+return(*piAbort);
+#endif
+}
+/**********************************************************************/
+static void vAbortSet(int *piAbort)
+{
+/* Sets *piAbort, read concurrently by the other rounds (iAbortGet). */
+
+#ifdef __PTHREADS__
+__atomic_store_n(piAbort, 1, __ATOMIC_RELAXED);
+#else
+*piAbort=1;
+#endif
+return;
+}
+/**********************************************************************/
+static void vPrPRound(void *pv, long l)
+{
+/* Pool task: one round of iPrPParallel, with a private modulus context
+   (the reduction scratch of a context may not be shared between
+   threads). A composite verdict sets iAbort, which makes the rounds
+   still running give up at their next squaring or Lucas step, and
+   those not yet started return at once. */
+
+struct __prp_job *pj=(struct __prp_job *)pv;
+struct __prp_round *pr=pj->pRound + pj->lFirst + l;
+struct __mpz_modctx mc;
+int iStat;
+
+if(iAbortGet(&pj->iAbort))return;
+__mpz_modctx_init(&mc, pj->mpzN);
+mc.iScreen=2;  /* small prime screening already done by the caller */
+mc.piAbort=&pj->iAbort;
+if(pr->iType==0)
+  iStat=iMillerCtx(pj->mpzN, pr->lB, &mc);
+else if(pr->iType==1)
+  iStat=iStrongLucasSelfridgeCtx(pj->mpzN, &mc);
+else
+  iStat=iExtraStrongLucasCtx(pj->mpzN, pr->lB, &mc);
+__mpz_modctx_clear(&mc);
+if(iStat==0)vAbortSet(&pj->iAbort);
+return;
+}
+/**********************************************************************/
+static int iPrPParallel(mpz_t mpzN, unsigned long ulNMR,
+  struct __mpz_modctx *pmc)
+{
+/* The rounds of iPrP (or of iBPSW, if ulNMR=1) for the odd N > 2,
+   dispatched to the thread pool. The base-2 Miller's test and the
+   strong Lucas-Selfridge test are run concurrently first; since
+   nearly every composite fails one of these, the extra Miller's and
+   extra strong Lucas tests are only dispatched (all together) once
+   both have passed. The first composite verdict cancels the other
+   rounds. Returns the same result as the serial code. */
+
+struct __prp_job job;
+unsigned long ul;
+long nRounds;
+
+if(iMillerScreen(mpzN, pmc) < 2)return(pmc->iScreen);
+if(!iPrime16Initialized)vGenPrimes16();
+if(ulNMR < 1)ulNMR=1;
+if(ulNMR > 6543)ulNMR=6543;
+
+job.pRound=(struct __prp_round *)
+  malloc((2 + ulNMR + ulNMR/5)*sizeof(struct __prp_round));
+if(job.pRound==NULL)
+  {
+  fprintf(stderr, "\n ***FATAL ERROR: malloc failed in iPrPParallel.\n");
+  exit(EXIT_FAILURE);
+  }
+nRounds=0;
+job.pRound[nRounds].iType=0;
+job.pRound[nRounds++].lB=2;
+job.pRound[nRounds].iType=1;
+job.pRound[nRounds++].lB=0;
+for(ul=2; ul <= ulNMR; ul++)
+  {
+  job.pRound[nRounds].iType=0;
+  job.pRound[nRounds++].lB=ulPrime16[ul];
+  if(ul%5==0)
+    {
+    job.pRound[nRounds].iType=2;
+    job.pRound[nRounds++].lB=ulPrime16[ul/5 + 1];
+    }
+  }
+
+job.mpzN=mpzN;
+job.iAbort=0;
+job.lFirst=0;
+vPoolRun(vPrPRound, &job, 2);
+if(!job.iAbort && nRounds > 2)
+  {
+  job.lFirst=2;
+  vPoolRun(vPrPRound, &job, nRounds - 2);
   }
-__mpz_set_ull(mpzN, ullN);
-return(iBPSW(mpzN));
+
+free(job.pRound);
+return(job.iAbort ? 0 : 1);
 }
 /**********************************************************************/
 int iPrP(mpz_t mpzN, unsigned long ulNMR, unsigned long ulMaxDivisor)
@@ -2399,11 +3010,16 @@ int iPrP(mpz_t mpzN, unsigned long ulNMR, unsigned long ulMaxDivisor)
  * additional extra strong Lucas test is performed after each five
  * Miller's tests.
  *
+ * If the thread pool has more than one thread (see iPoolThreads),
+ * and N has at least PRP_PARALLEL_BITS binary digits, the tests are
+ * run concurrently by iPrPParallel.
+ *
  */
 
 int iComp2;
 unsigned long qMax;
 unsigned long ulDiv, ul;
+struct __mpz_modctx mc;
 
 /* First eliminate all N < 3 and all even N. */
 
@@ -2422,12 +3038,27 @@ if(ulMaxDivisor > qMax)
   if(ulDiv > 1)return(0);
   }
 
-if(iMiller(mpzN, 2)==0)return(0);  /* Carry out Miller's test with base 2 */
+/* All the tests below share a single modulus context for N. */
+
+__mpz_modctx_init(&mc, mpzN);
+
+#undef RETURN
+#define RETURN(n) {__mpz_modctx_clear(&mc); return(n);}
+
+/* With a thread pool, the rounds for larger N are run concurrently. */
+
+if((mc.ulBits >= PRP_PARALLEL_BITS) && (iPoolThreads(0) > 1))
+  {
+  iComp2=iPrPParallel(mpzN, ulNMR, &mc);
+  RETURN(iComp2);
+  }
+
+if(iMillerCtx(mpzN, 2, &mc)==0)RETURN(0);  /* Miller's test, B=2 */
 
 /* Now N is a prime, or a base-2 strong pseudoprime with no small
    prime divisors. Apply the strong Lucas-Selfridge primality test. */
 
-if(iStrongLucasSelfridge(mpzN)==0)return(0);
+if(iStrongLucasSelfridgeCtx(mpzN, &mc)==0)RETURN(0);
 
 /* The following is in addition to the strong Baillie-PSW test.
    Additional Miller's tests (numbering ulNMR - 1) can be
@@ -2435,51 +3066,759 @@ if(iStrongLucasSelfridge(mpzN)==0)return(0);
    In addition, after each five Miller's tests, we perform
    an extra strong Lucas test. */
 
-if(ulNMR < 2)return(1);
+if(ulNMR < 2)RETURN(1);
 if(ulNMR > 6543)ulNMR=6543;
 if(!iPrime16Initialized)vGenPrimes16();
 for(ul=2; ul <= ulNMR; ul++)
   {
-  if(iMiller(mpzN, ulPrime16[ul])==0)return(0);
+  if(iMillerCtx(mpzN, ulPrime16[ul], &mc)==0)RETURN(0);
   if(ul%5==0)
-    if(iExtraStrongLucas(mpzN, ulPrime16[ul/5 + 1])==0)return(0);
+    if(iExtraStrongLucasCtx(mpzN, ulPrime16[ul/5 + 1], &mc)==0)RETURN(0);
   }
 
-return(1);
+RETURN(1);
 }
 /**********************************************************************/
-unsigned long ulPrmDiv(mpz_t mpzN, unsigned long ulMaxDivisor)
+struct __prpbatch_job
+  {
+  mpz_t *pmpzN;
+  int *piResult;
+  struct __prpbatch_opts *pOpts;
+  mpz_t mpzP;               /* product of the odd primes to ulTD */
+  unsigned long ulTD;       /* trial divisor bound, <= 65521 */
+  long lFirst;              /* least index known prime (stop mode) */
+  };
+/**********************************************************************/
+static long lPrPBatchFirst(struct __prpbatch_job *pj)
 {
-/* Returns the smallest proper prime divisor (p <= ulMaxDivisor) of N.
+/* pj->lFirst, as read by a pool task (see vPrPBatchFound). */
 
-   If N < 2, return 0.
-   If N is prime and "small", return 1. "Small" means N < approximately
-     ulMaxDivisor^2.
-   If N is prime and "large", return 0. "Large" means N > approximately
-     ulMaxDivisor^2.
-   If N is composite and its smallest prime divisor p <= ulMaxDivisor,
-     return p.
-   If N is composite but its smallest prime divisor p > ulMaxDivisor,
-     return 0. In this case N will be "large", as above.
+#ifdef __PTHREADS__
+return(__atomic_load_n(&pj->lFirst, __ATOMIC_RELAXED));
+#else
+return(pj->lFirst);
+#endif
+}
+/**********************************************************************/
+static void vPrPBatchFound(struct __prpbatch_job *pj, long l)
+{
+/* Lowers pj->lFirst to l, if l is less. Several pool tasks may find a
+   prime at once, so that the minimum is taken by compare-and-swap: a
+   plain test and store could let a greater index overwrite a lesser
+   one, and the elements between them would go untested. */
 
-   A return of 0 indicates "no conclusion"; N might be < 2
-   (questionable input), or N might be "large" (either prime
-   or composite) and have no prime divisor p <= ulMaxDivisor.
+#ifdef __PTHREADS__
+long lOld=__atomic_load_n(&pj->lFirst, __ATOMIC_RELAXED);
 
-   A return of 1 indicates that N is a "small" prime.
+while((l < lOld) && !__atomic_compare_exchange_n(&pj->lFirst, &lOld, l,
+  0, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+#else
+if(l < pj->lFirst)pj->lFirst=l;
+#endif
+return;
+}
+/**********************************************************************/
+static void vPrPBatchTD(void *pv, long l)
+{
+/* Pool task: trivial cases and trial division of N[l] by the odd
+   primes to ulTD, as a single gcd with their product. Sets
+   piResult[l] to 0 or 1 if that settles N[l], and to -2 otherwise. */
 
-   A return > 1 indicates that N is composite, and the
-   returned value is the smallest proper prime divisor of N.
+struct __prpbatch_job *pj=(struct __prpbatch_job *)pv;
+mpz_ptr mpzN=pj->pmpzN[l];
+unsigned long ulR, ulBits;
+int iComp2;
+mpz_t mpzG;
 
-   If ulMaxDivisor is zero or one, a default value of 1000 is used.
-*/
+pj->piResult[l]=-2;
+iComp2=mpz_cmp_si(mpzN, 2);
+if(iComp2 < 0){pj->piResult[l]=0; return;}
+if(iComp2==0){pj->piResult[l]=1; return;}
+if(mpz_even_p(mpzN)){pj->piResult[l]=0; return;}
+ulBits=mpz_sizeinbase(mpzN, 2);
+if((pj->ulTD < 3) || (pj->pOpts->ulMaxDivisor <= ulBits))return;
+
+mpz_init(mpzG);
+mpz_gcd(mpzG, mpzN, pj->mpzP);
+if(mpz_cmp(mpzG, mpzN)==0)
+  pj->piResult[l]=1;  /* N is one of the primes in the product */
+else if(mpz_cmp_ui(mpzG, 1) > 0)
+  pj->piResult[l]=0;
+else if(ulBits <= 32)
+  {
+  ulR=mpz_get_ui(mpzN);
+  if((uint64_t)pj->ulTD*pj->ulTD > ulR)pj->piResult[l]=1;
+  }
+mpz_clear(mpzG);
+return;
+}
+/**********************************************************************/
+static void vPrPBatchTest(void *pv, long l)
+{
+/* Pool task: the probable prime test of N[l], if still undecided. In
+   stop mode, elements beyond the first prime known are skipped. */
+
+struct __prpbatch_job *pj=(struct __prpbatch_job *)pv;
+struct __prpbatch_opts *po=pj->pOpts;
+mpz_ptr mpzN=pj->pmpzN[l];
+struct __mpz_modctx mc;
+mpz_t mpzRem, mpzTwo;
+int iStat;
 
-int iComp2, i;
-unsigned long ul, ulDiv, ulBase;
-static mpz_t mpzSqrt;
-static int d[8]={1,7,11,13,17,19,23,29}, iFirst=1;
+if(pj->piResult[l] != -2)return;
+if(po->iStopAtPrime && (l > lPrPBatchFirst(pj)))
+  {
+  pj->piResult[l]=-1;
+  return;
+  }
 
-/* First eliminate all N < 3 and all even N. */
+if(po->iFermat)  /* 2^N == 2 (mod N) */
+  {
+  mpz_init(mpzRem);
+  mpz_init_set_ui(mpzTwo, 2);
+  __mpz_modctx_init(&mc, mpzN);
+  __mpz_powm_ctx(mpzRem, mpzTwo, mpzN, &mc);
+  __mpz_modctx_clear(&mc);
+  iStat=(mpz_cmp(mpzRem, mpzTwo)==0);
+  mpz_clear(mpzRem);
+  mpz_clear(mpzTwo);
+  if(!iStat)
+    {
+    pj->piResult[l]=0;
+    return;
+    }
+  }
+
+if(po->iMR2)
+  iStat=iMillerRabin(mpzN, 2);
+else
+  iStat=iPrP(mpzN, po->ulNMR,
+    (po->ulMaxDivisor > pj->ulTD) ? po->ulMaxDivisor : 2);
+pj->piResult[l]=iStat;
+if(iStat)vPrPBatchFound(pj, l);
+return;
+}
+/**********************************************************************/
+int iPrPBatch(mpz_t *pmpzN, size_t n, int *piResult,
+  struct __prpbatch_opts *pOpts)
+{
+/* Tests the n integers N[0], ..., N[n-1] for (probable) primality,
+   as iPrP does (or iMillerRabin with base 2, if pOpts->iMR2 is set),
+   storing 1 (prime) or 0 (composite) in piResult[i]. Returns the least
+   index i for which N[i] was found prime, or -1 if there is none.
+
+   The work is done in two phases, each spread over the thread pool
+   (see vPoolRun). First the trial division is done for the whole
+   batch, each N being tested against the product of the odd primes to
+   min(ulMaxDivisor, 65521) with a single gcd (as in iPrP, only for N
+   having fewer binary digits than ulMaxDivisor). Then the remaining
+   N are tested, preceded by a base-2 Fermat test if pOpts->iFermat is
+   set (as in the interior scan of a gap, where nearly all candidates
+   are composite).
+
+   If pOpts->iStopAtPrime is set, the elements beyond the first prime
+   found (in index order) need not be tested, and piResult is set to
+   -1 for those skipped; every element before the returned index is
+   always tested. */
+
+struct __prpbatch_job job;
+unsigned long ul, ulBits;
+long l;
+
+if(n==0)return(-1);
+if(!iPrime16Initialized)vGenPrimes16();  /* before any threads start */
+
+job.pmpzN=pmpzN;
+job.piResult=piResult;
+job.pOpts=pOpts;
+job.lFirst=LONG_MAX;
+job.ulTD=__MIN2(pOpts->ulMaxDivisor, 65521UL);
+
+/* The product of the odd primes to ulTD is needed only if some N has
+   fewer binary digits than ulMaxDivisor. */
+
+mpz_init_set_ui(job.mpzP, 1);
+ulBits=ULONG_MAX;
+for(l=0; l < (long)n; l++)
+  ulBits=__MIN2(ulBits, mpz_sizeinbase(pmpzN[l], 2));
+if(pOpts->ulMaxDivisor <= ulBits)job.ulTD=0;
+for(ul=2; ulPrime16[ul] <= job.ulTD; ul++)
+  mpz_mul_ui(job.mpzP, job.mpzP, ulPrime16[ul]);
+
+vPoolRun(vPrPBatchTD, &job, n);
+mpz_clear(job.mpzP);
+if(pOpts->iStopAtPrime)
+  for(l=0; l < (long)n; l++)
+    if(piResult[l]==1)
+      {
+      job.lFirst=l;
+      break;
+      }
+vPoolRun(vPrPBatchTest, &job, n);
+
+for(l=0; l < (long)n; l++)
+  if(piResult[l]==1)return((int)l);
+return(-1);
+}
+/**********************************************************************/
+static double lfDickmanRho(double lfU)
+{
+/* Dickman's function rho(u), the probability that a random integer
+   near x has no prime factor exceeding x^(1/u). Exact for u <= 2, and
+   interpolated log-linearly between tabulated integer values beyond
+   that (ample for the cost estimates of ulPMinus1B1). */
+
+static const double lfRho[11]={1, 1, 3.068528194e-1, 4.860838829e-2,
+  4.910925648e-3, 3.547247005e-4, 1.964969635e-5, 8.745670263e-7,
+  3.232069304e-8, 1.016248283e-9, 2.770171838e-11};
+int k;
+
+if(lfU <= 1)return(1);
+if(lfU <= 2)return(1 - log(lfU));
+if(lfU >= 10)return(0);
+k=(int)lfU;
+return(exp(log(lfRho[k]) + (lfU - k)*(log(lfRho[k+1]) - log(lfRho[k]))));
+}
+/**********************************************************************/
+unsigned long ulPMinus1B1(unsigned long ulBits, double lfTD)
+{
+/* Cost model for the Pollard P-1 stage 1 prefilter (iPMinus1) of
+   integers of ulBits bits, already known to have no prime divisor
+   below lfTD, which would otherwise be given a base-2 Fermat test.
+   Returns the bound B1 (at most 65521, the range of ulPrime16[])
+   expected to save the most time, or 0 if no B1 is expected to save
+   any.
+
+   The cost of stage 1 is about 1.44*B1 modular squarings (the bit
+   length of its exponent), plus a gcd worth about six, against
+   ulBits squarings for the Fermat test it may spare. Its chance of
+   success is estimated as the sum, over the possible prime divisors
+   p > lfTD, of 1/p (by Mertens' theorem, the density of a divisor of
+   size p given that there is none below lfTD) times rho(ln p/ln B1),
+   the chance that p - 1 is B1-smooth. In practice the stage pays
+   only for very large N (about 200000 digits with the sieve bounds
+   of cglp4), unless the sieve bound lfTD is small. */
+
+double lfB1, lfP, lfNet, lfBest, lfT, lfLnB1, lfTMax;
+unsigned long ulB1Best;
+
+if(lfTD < 3)lfTD=3;
+lfTMax=0.5*ulBits*log(2.0);
+lfBest=0;
+ulB1Best=0;
+for(lfB1=100; lfB1 <= 65521; lfB1 *= 1.2)
+  {
+  lfLnB1=log(lfB1);
+  lfP=0;
+  for(lfT=log(lfTD); lfT < lfTMax; lfT += 0.05)
+    {
+    if(lfT > 10*lfLnB1)break;
+    lfP += lfDickmanRho(lfT/lfLnB1)*0.05/lfT;
+    }
+  lfNet=lfP*ulBits - 1.4427*lfB1 - 6;
+  if(lfNet > lfBest)
+    {
+    lfBest=lfNet;
+    ulB1Best=(unsigned long)lfB1;
+    }
+  }
+
+return(ulB1Best);
+}
+/**********************************************************************/
+void vPMinus1Exp(mpz_t mpzE, unsigned long ulB1)
+{
+/* Sets E to the stage 1 exponent of iPMinus1, the product of the
+   greatest powers q^k <= B1 of the primes q <= B1 (B1 <= 65521). */
+
+unsigned long ul, ulQ, ulQk;
+
+if(!iPrime16Initialized)vGenPrimes16();
+if(ulB1 > 65521UL)ulB1=65521UL;
+mpz_set_ui(mpzE, 1);
+for(ul=1; ul < 6543; ul++)
+  {
+  ulQ=ulPrime16[ul];
+  if(ulQ > ulB1)break;
+  for(ulQk=ulQ; ulQk <= ulB1/ulQ; ulQk *= ulQ);
+  mpz_mul_ui(mpzE, mpzE, ulQk);
+  }
+
+return;
+}
+/**********************************************************************/
+int iPMinus1(mpz_t mpzF, mpz_t mpzN, mpz_t mpzE)
+{
+/* Pollard's P-1 method, stage 1 only, with the exponent E from
+   vPMinus1Exp: F = gcd(3^E - 1, N). Returns 1 if a proper divisor
+   1 < F < N of N was found, and 0 otherwise (in particular, a prime N
+   never yields one). N must be odd and > 3. The modular
+   exponentiation uses a modulus context, so that N = 2^n + c, as in
+   the interior of a gap following such a P1, is reduced cheaply. */
+
+struct __mpz_modctx mc;
+mpz_t mpzA, mpzB;
+int iFound;
+
+mpz_init(mpzA);
+mpz_init_set_ui(mpzB, 3);
+__mpz_modctx_init(&mc, mpzN);
+__mpz_powm_ctx(mpzA, mpzB, mpzE, &mc);
+__mpz_modctx_clear(&mc);
+mpz_sub_ui(mpzA, mpzA, 1);
+mpz_gcd(mpzF, mpzA, mpzN);
+iFound=(mpz_cmp_ui(mpzF, 1) > 0) && (mpz_cmp(mpzF, mpzN) < 0);
+mpz_clear(mpzA);
+mpz_clear(mpzB);
+
+return(iFound);
+}
+/**********************************************************************/
+struct __prover *pProverNew(const char *szSpec)
+{
+/* Creates a prover (see lProverTest) from its specification: "gmp",
+   "mock", "batch=<command>", or "coproc=<command>". Returns NULL if
+   the specification is not recognized, or if coproc is requested and
+   __COPROC__ is not defined. The prover's temporary files, if any,
+   are named after the process; the caller may change szIn and szOut.
+   Nothing is run until the first lProverTest. */
+
+struct __prover *ppr;
+const char *pch;
+int iKind;
+unsigned long ulPid=0;
+
+pch=strchr(szSpec, '=');
+if(!strcmp(szSpec, "gmp"))
+  iKind=PROVER_GMP;
+else if(!strcmp(szSpec, "mock"))
+  iKind=PROVER_MOCK;
+else if(pch && (pch - szSpec==5) && !strncmp(szSpec, "batch", 5))
+  iKind=PROVER_BATCH;
+else if(pch && (pch - szSpec==6) && !strncmp(szSpec, "coproc", 6))
+  iKind=PROVER_COPROC;
+else
+  return(NULL);
+if(((iKind==PROVER_BATCH) || (iKind==PROVER_COPROC)) && !pch[1])
+  return(NULL);
+#ifndef __COPROC__
+if(iKind==PROVER_COPROC)return(NULL);
+#endif
+
+ppr=(struct __prover *)calloc(1, sizeof(struct __prover));
+if(!ppr)return(NULL);
+ppr->iKind=iKind;
+ppr->szSpec=(char *)malloc(strlen(szSpec) + 1);
+if(!ppr->szSpec)
+  {
+  free(ppr);
+  return(NULL);
+  }
+strcpy(ppr->szSpec, szSpec);
+if(pch)ppr->szCmd=ppr->szSpec + (pch - szSpec) + 1;
+#if !defined(__DMC__) && !defined(__BORLANDC__)
+ulPid=(unsigned long)getpid();
+#endif
+sprintf(ppr->szIn, "prover%lu.in", ulPid);
+sprintf(ppr->szOut, "prover%lu.out", ulPid);
+mpz_init(ppr->mpzBase);
+#ifdef __COPROC__
+ppr->iPid=-1;
+#endif
+
+return(ppr);
+}
+/**********************************************************************/
+static void vProverFail(struct __prover *ppr)
+{
+/* Disables an external prover which has failed, with a warning. */
+
+if(ppr->iFailed)return;
+ppr->iFailed=1;
+vProgressClear();
+fprintf(stderr, "\n WARNING: Unable to run %s; continuing without it.\n",
+  ppr->szCmd);
+return;
+}
+/**********************************************************************/
+static int iProverGMP(struct __prover *ppr, mpz_t mpzBase,
+  unsigned long *pulOff, long n, int *piResult,
+  struct __prpbatch_opts *pOpts)
+{
+/* PROVER_GMP and PROVER_MOCK: the candidates are tested here, by
+   iPrPBatch or (for the mock) by GMP's own mpz_probab_prime_p. */
+
+struct __prpbatch_opts opts;
+long l;
+
+if(n > ppr->nMpz)
+  {
+  for(l=0; l < ppr->nMpz; l++)mpz_clear(ppr->pmpz[l]);
+  free(ppr->pmpz);
+  ppr->pmpz=(mpz_t *)malloc(n*sizeof(mpz_t));
+  ppr->nMpz=0;
+  if(!ppr->pmpz)return(-2);
+  for(l=0; l < n; l++)mpz_init(ppr->pmpz[l]);
+  ppr->nMpz=n;
+  }
+for(l=0; l < n; l++)mpz_add_ui(ppr->pmpz[l], mpzBase, pulOff[l]);
+
+if(ppr->iKind==PROVER_GMP)
+  {
+  if(!pOpts)
+    {
+    opts.ulNMR=1;
+    opts.ulMaxDivisor=2;
+    opts.iMR2=0;
+    opts.iFermat=1;
+    opts.iStopAtPrime=1;
+    pOpts=&opts;
+    }
+  return(iPrPBatch(ppr->pmpz, n, piResult, pOpts));
+  }
+for(l=0; l < n; l++)
+  piResult[l]=(mpz_probab_prime_p(ppr->pmpz[l], 1) > 0);
+return(0);
+}
+/**********************************************************************/
+static int iProverBatch(struct __prover *ppr, mpz_t mpzBase,
+  unsigned long *pulOff, long n, int *piResult)
+{
+/* PROVER_BATCH: the candidates are written to szIn as an ABC file (a
+   header "ABC <base>+$a", the base in decimal, then one offset to a
+   line), the command is run once, and its output is read from szOut.
+   In the command, %i stands for szIn and %o for szOut (%% for %); if
+   there is no %i, szIn is appended, and if there is no %o, the output
+   is redirected to szOut. A line "<...>+<offset> is <...>" gives the
+   verdict on that offset: composite if it reports a composite, else
+   PRP if it reports a PRP or prime; other lines are ignored. This is
+   the form of the output of PFGW (without -Cquiet, which omits the
+   composites). The run fails (-2) unless the command exits with
+   status 0 and every offset has a verdict, so that a tester which
+   fails, or reports nothing, is never taken to have found the
+   candidates composite. */
+
+char *szCmd, *pchBuf, *pch, *pch2, *pchEOL, *ep;
+unsigned long ul;
+long l, lLo, lHi, lSize;
+int iStat, iIn=0, iOut=0;
+FILE *fp;
+
+for(pch=ppr->szCmd, l=0; *pch; pch++)if(*pch=='%')l++;
+szCmd=(char *)malloc(strlen(ppr->szCmd) + (l + 2)*sizeof(ppr->szIn) + 8);
+if(!szCmd)return(-2);
+for(pch=ppr->szCmd, pch2=szCmd; *pch; pch++)
+  {
+  if((pch[0]=='%') && (pch[1]=='i'))
+    {
+    strcpy(pch2, ppr->szIn);
+    iIn=1;
+    }
+  else if((pch[0]=='%') && (pch[1]=='o'))
+    {
+    strcpy(pch2, ppr->szOut);
+    iOut=1;
+    }
+  else if((pch[0]=='%') && (pch[1]=='%'))
+    strcpy(pch2, "%");
+  else
+    {
+    *pch2++=*pch;
+    continue;
+    }
+  pch2 += strlen(pch2);
+  pch++;
+  }
+*pch2=0;
+if(!iIn)sprintf(pch2, " %s", ppr->szIn);
+if(!iOut)sprintf(pch2 + strlen(pch2), " > %s", ppr->szOut);
+
+fp=fopen(ppr->szIn, "wt");
+if(fp)
+  {
+  gmp_fprintf(fp, "ABC %Zd+$a\n", mpzBase);
+  for(l=0; l < n; l++)fprintf(fp, "%lu\n", pulOff[l]);
+  if(fclose(fp))fp=NULL;
+  }
+remove(ppr->szOut);
+iStat=-1;
+if(fp)
+  {
+  iStat=system(szCmd);
+  if(iStat != 0)iStat=-1;  /* not run, or failed */
+  }
+free(szCmd);
+lSize=__lFile(ppr->szOut);
+pchBuf=NULL;
+if((iStat != -1) && (lSize >= 0))
+  {
+  pchBuf=(char *)malloc(lSize + 1);
+  fp=fopen(ppr->szOut, "rb");
+  if(pchBuf && fp && (fread(pchBuf, 1, lSize, fp)==(size_t)lSize))
+    pchBuf[lSize]=0;
+  else
+    {
+    free(pchBuf);
+    pchBuf=NULL;
+    }
+  if(fp)fclose(fp);
+  }
+if(!pchBuf)return(-2);
+
+for(l=0; l < n; l++)piResult[l]=-1;  /* no verdict yet */
+for(pch=pchBuf; *pch; pch=pchEOL)
+  {
+  pchEOL=strchr(pch, '\n');
+  if(pchEOL)
+    *pchEOL++=0;
+  else
+    pchEOL=pch + strlen(pch);
+  pch2=strstr(pch, " is ");
+  if(!pch2)continue;
+  if(strstr(pch2, "composite"))
+    iStat=0;
+  else if(strstr(pch2, "PRP") || strstr(pch2, "prime"))
+    iStat=1;
+  else
+    continue;
+  *pch2=0;
+  pch2=strrchr(pch, '+');
+  if(!pch2)continue;
+  ul=strtoul(pch2 + 1, &ep, 10);
+  if(ep==pch2 + 1)continue;
+  for(lLo=0, lHi=n - 1; lLo <= lHi; )  /* binary search of pulOff */
+    {
+    l=(lLo + lHi)/2;
+    if(pulOff[l]==ul)
+      {
+      piResult[l]=iStat;
+      break;
+      }
+    if(pulOff[l] < ul)
+      lLo=l + 1;
+    else
+      lHi=l - 1;
+    }
+  }
+free(pchBuf);
+
+for(l=0; l < n; l++)
+  if(piResult[l] < 0)return(-2);  /* an offset unaccounted for */
+return(0);
+}
+/**********************************************************************/
+#ifdef __COPROC__
+#define PROVER_SLICE 64  /* candidates sent before their replies are read */
+static int iProverCoproc(struct __prover *ppr, mpz_t mpzBase,
+  unsigned long *pulOff, long n, int *piResult)
+{
+/* PROVER_COPROC: the command is started once (through /bin/sh), with
+   its standard input and output on pipes, and is sent
+
+     B <base>      the base of the candidates which follow, in decimal
+                   (sent only when it changes)
+     T <offset>    a candidate, base + offset
+     F             the end of a batch
+     Q             the end of the session, whereupon it should exit
+
+   one to a line. For each T line, in order, it must write one line
+   "<offset> <verdict>" (of fewer than 256 characters), the verdict
+   beginning with P (probable prime) or C (composite), and flush its
+   output at each F at the latest. Any other reply, or the loss of the
+   process, is a failure. The candidates are sent in slices of at most
+   PROVER_SLICE, each ended by F, and the replies to each slice are read
+   before the next is sent; the replies to a slice being smaller than
+   any pipe, neither side can then be left waiting on a full pipe while
+   the other does the same. The pipes are closed on exec, so that they
+   are not inherited by other commands (those of PROVER_BATCH). */
+
+char sz[256], *ep;
+int fdTo[2], fdFrom[2];
+long l, l0, l1;
+unsigned long ul;
+
+if(ppr->iPid < 0)
+  {
+  if(pipe(fdTo))return(-2);
+  if(pipe(fdFrom))
+    {
+    close(fdTo[0]);
+    close(fdTo[1]);
+    return(-2);
+    }
+  for(l=0; l < 2; l++)
+    {
+    fcntl(fdTo[l], F_SETFD, FD_CLOEXEC);  /* dup2 clears it for 0, 1 */
+    fcntl(fdFrom[l], F_SETFD, FD_CLOEXEC);
+    }
+  fflush(NULL);
+  ppr->iPid=fork();
+  if(ppr->iPid==0)
+    {
+    dup2(fdTo[0], 0);
+    dup2(fdFrom[1], 1);
+    close(fdTo[0]);
+    close(fdTo[1]);
+    close(fdFrom[0]);
+    close(fdFrom[1]);
+    execl("/bin/sh", "sh", "-c", ppr->szCmd, (char *)NULL);
+    _exit(127);
+    }
+  close(fdTo[0]);
+  close(fdFrom[1]);
+  if(ppr->iPid < 0)
+    {
+    close(fdTo[1]);
+    close(fdFrom[0]);
+    return(-2);
+    }
+  signal(SIGPIPE, SIG_IGN);  /* a lost coprocess is seen as an error */
+  ppr->fpTo=fdopen(fdTo[1], "w");
+  ppr->fpFrom=fdopen(fdFrom[0], "r");
+  if(!ppr->fpTo || !ppr->fpFrom)return(-2);
+  ppr->iBase=0;
+  }
+
+if(!ppr->iBase || mpz_cmp(ppr->mpzBase, mpzBase))
+  {
+  gmp_fprintf(ppr->fpTo, "B %Zd\n", mpzBase);
+  mpz_set(ppr->mpzBase, mpzBase);
+  ppr->iBase=1;
+  }
+for(l0=0; l0 < n; l0=l1)
+  {
+  l1=__MIN2(n, l0 + PROVER_SLICE);
+  for(l=l0; l < l1; l++)fprintf(ppr->fpTo, "T %lu\n", pulOff[l]);
+  fprintf(ppr->fpTo, "F\n");
+  if(fflush(ppr->fpTo))return(-2);
+  for(l=l0; l < l1; l++)
+    {
+    if(!fgets(sz, sizeof(sz), ppr->fpFrom))return(-2);
+    ul=strtoul(sz, &ep, 10);
+    if((ep==sz) || (ul != pulOff[l]))return(-2);
+    while(*ep==' ')ep++;
+    if(toupper(*ep)=='P')
+      piResult[l]=1;
+    else if(toupper(*ep)=='C')
+      piResult[l]=0;
+    else
+      return(-2);
+    }
+  }
+
+return(0);
+}
+#endif  /* __COPROC__ */
+/**********************************************************************/
+long lProverTest(struct __prover *ppr, mpz_t mpzBase,
+  unsigned long *pulOff, long n, int *piResult,
+  struct __prpbatch_opts *pOpts)
+{
+/* Tests the n candidates base + pulOff[i] with the prover ppr, storing
+   its verdict in piResult[i]: 1 (probable prime), 0 (composite), or
+   -1 (not tested; PROVER_GMP with pOpts->iStopAtPrime). pOpts applies
+   to PROVER_GMP alone, and may be NULL. Returns the least index i for
+   which the candidate was reported prime, or -1 if there is none. If
+   an external prover fails, it is disabled, with a warning, and -2 is
+   returned, now and for every later call; the caller should then test
+   the candidates itself. The verdicts of an external prover are its
+   own, and should be confirmed. */
+
+long l;
+int iStat=-2;
+
+if(ppr->iFailed)return(-2);
+if(n <= 0)return(-1);
+
+switch(ppr->iKind)
+  {
+  case PROVER_GMP:
+  case PROVER_MOCK:
+    iStat=iProverGMP(ppr, mpzBase, pulOff, n, piResult, pOpts);
+    if(ppr->iKind==PROVER_GMP)return(iStat);
+    break;
+  case PROVER_BATCH:
+    iStat=iProverBatch(ppr, mpzBase, pulOff, n, piResult);
+    break;
+#ifdef __COPROC__
+  case PROVER_COPROC:
+    iStat=iProverCoproc(ppr, mpzBase, pulOff, n, piResult);
+    break;
+#endif
+  }
+if(iStat==-2)
+  {
+  vProverFail(ppr);
+  return(-2);
+  }
+
+for(l=0; l < n; l++)
+  if(piResult[l]==1)return(l);
+return(-1);
+}
+/**********************************************************************/
+void vProverClose(struct __prover *ppr)
+{
+/* Ends a prover: a coprocess is told to quit and waited for, and the
+   temporary files are removed. */
+
+long l;
+
+if(!ppr)return;
+#ifdef __COPROC__
+if(ppr->fpTo)
+  {
+  fprintf(ppr->fpTo, "Q\n");
+  fclose(ppr->fpTo);
+  }
+if(ppr->fpFrom)fclose(ppr->fpFrom);
+if(ppr->iPid > 0)waitpid(ppr->iPid, NULL, 0);
+#endif
+if(ppr->iKind==PROVER_BATCH)
+  {
+  remove(ppr->szIn);
+  remove(ppr->szOut);
+  }
+for(l=0; l < ppr->nMpz; l++)mpz_clear(ppr->pmpz[l]);
+free(ppr->pmpz);
+mpz_clear(ppr->mpzBase);
+free(ppr->szSpec);
+free(ppr);
+return;
+}
+/**********************************************************************/
+unsigned long ulPrmDiv(mpz_t mpzN, unsigned long ulMaxDivisor)
+{
+/* Returns the smallest proper prime divisor (p <= ulMaxDivisor) of N.
+
+   If N < 2, return 0.
+   If N is prime and "small", return 1. "Small" means N < approximately
+     ulMaxDivisor^2.
+   If N is prime and "large", return 0. "Large" means N > approximately
+     ulMaxDivisor^2.
+   If N is composite and its smallest prime divisor p <= ulMaxDivisor,
+     return p.
+   If N is composite but its smallest prime divisor p > ulMaxDivisor,
+     return 0. In this case N will be "large", as above.
+
+   A return of 0 indicates "no conclusion"; N might be < 2
+   (questionable input), or N might be "large" (either prime
+   or composite) and have no prime divisor p <= ulMaxDivisor.
+
+   A return of 1 indicates that N is a "small" prime.
+
+   A return > 1 indicates that N is composite, and the
+   returned value is the smallest proper prime divisor of N.
+
+   If ulMaxDivisor is zero or one, a default value of 1000 is used.
+*/
+
+int iComp2, i;
+unsigned long ul, ulDiv, ulBase;
+mpz_t mpzSqrt;
+static int d[8]={1,7,11,13,17,19,23,29};
+
+/* First eliminate all N < 3 and all even N. */
 
 iComp2=mpz_cmp_si(mpzN, 2);
 if(iComp2 < 0)return(0);  /* No conclusion (N < 2) */
@@ -2490,21 +3829,20 @@ if(!iPrime16Initialized)vGenPrimes16();
 if(ulMaxDivisor < 2)ulMaxDivisor=1000UL;
 if(ulMaxDivisor > MAX_32BIT_PRIME)ulMaxDivisor=MAX_32BIT_PRIME;
 
-if(iFirst)
-  {
-  mpz_init(mpzSqrt);
-  iFirst=0;
-  }
+mpz_init(mpzSqrt);  /* local, so that concurrent calls are safe */
 mpz_sqrt(mpzSqrt, mpzN);
 
+#undef RETURN
+#define RETURN(n) {mpz_clear(mpzSqrt); return(n);}
+
 ul=2;  /* first trial divisor will be 3, the 2nd prime */
 while(1)
   {
   ulDiv=ulPrime16[ul++];
-  if(ulDiv > ulMaxDivisor)return(0);  /* No conclusion */
+  if(ulDiv > ulMaxDivisor)RETURN(0);  /* No conclusion */
   if(ulDiv > 65536UL)break;
-  if(mpz_cmp_ui(mpzSqrt, ulDiv) < 0)return(1);  /* Prime */
-  if(mpz_divisible_ui_p(mpzN, ulDiv))return(ulDiv);  /* Composite */
+  if(mpz_cmp_ui(mpzSqrt, ulDiv) < 0)RETURN(1);  /* Prime */
+  if(mpz_divisible_ui_p(mpzN, ulDiv))RETURN(ulDiv);  /* Composite */
   }
 
 /* Once the 16-bit divisors have been exhausted, use trial divisors of
@@ -2516,14 +3854,14 @@ while(1)
   for(i=0; i < 8; i++)
     {
     ulDiv=ulBase + d[i];
-    if(ulDiv > ulMaxDivisor)return(0);  /* No conclusion */
-    if(mpz_cmp_ui(mpzSqrt, ulDiv) < 0)return(1);  /* Prime */
-    if(mpz_divisible_ui_p(mpzN, ulDiv))return(ulDiv);  /* Composite */
+    if(ulDiv > ulMaxDivisor)RETURN(0);  /* No conclusion */
+    if(mpz_cmp_ui(mpzSqrt, ulDiv) < 0)RETURN(1);  /* Prime */
+    if(mpz_divisible_ui_p(mpzN, ulDiv))RETURN(ulDiv);  /* Composite */
     }
   ulBase += 30;
   }
 
-return(0);  /* No conclusion */
+RETURN(0);  /* No conclusion */
 }
 /**********************************************************************/
 int iMillerRabin(mpz_t mpzN, const long iB)
@@ -2571,49 +3909,81 @@ int iMiller(mpz_t mpzN, long iB)
    unnecessary complication to the test.
 */
 
-static long iFirst=1;
-static mpz_t mpzB, mpzNm1, mpzd, mpzRem, mpzSqrt, mpzOne;
-long iComp2, iBits, s, j, q, digits;
-unsigned long qMax;
-
-/* Allocate the static variables used in Miller's test. */
+struct __mpz_modctx mc;
+int iStat;
 
-if(iFirst)
-  {
-  mpz_init(mpzB);  /* Never needs more than one limb */
-  iBits=mp_bits_per_limb*(1 + mpz_size(mpzN));
-  if(iBits < 512)iBits=512;
-  mpz_init2(mpzNm1, iBits);
-  mpz_init2(mpzOne, iBits);
-  mpz_set_si(mpzOne, 1);
-  mpz_init2(mpzd, iBits);
-  mpz_init2(mpzRem, 2*iBits);  /* must contain products */
-  if(!iPrime16Initialized)vGenPrimes16();
-  iFirst=0;
-  }
+if(mpz_cmp_si(mpzN, 2) <= 0)return(mpz_cmp_si(mpzN, 2)==0);
+if(mpz_even_p(mpzN))return(0);
+__mpz_modctx_init(&mc, mpzN);
+iStat=iMillerCtx(mpzN, iB, &mc);
+__mpz_modctx_clear(&mc);
+return(iStat);
+}
+/**********************************************************************/
+static int iMillerScreen(mpz_t mpzN, struct __mpz_modctx *pmc)
+{
+/* Small prime screening for Miller's test on the odd N > 2, carried
+   out only on the first call for the context pmc. Returns (and caches
+   in pmc->iScreen) 0 if N is composite, 1 if N is prime, and 2 if no
+   conclusion is reached. */
 
-/* First take care of all N < 3 and all even N. */
+unsigned long qMax, ulSqrtN;
+long j, q;
+mpz_t mpzSqrt;
 
-iComp2=mpz_cmp_si(mpzN, 2);
-if(iComp2 < 0)return(0);        /* N < 2 is by convention not prime */
-if(iComp2==0)return(1);         /* N=2 is prime */
-if(mpz_even_p(mpzN))return(0);  /* Even N > 2 is composite */
+if(pmc->iScreen >= 0)return(pmc->iScreen);
 
 /* Try small prime divisors from 3 to an UB qMax determined by the size
-   of N (qMax >= 31). */
+   of N (qMax >= 31). Since qMax*qMax < N whenever N has 36 or more
+   binary digits, sqrt(N) need only be found for smaller N. */
 
-mpz_sqrt(mpzSqrt, mpzN);
-qMax=mpz_sizeinbase(mpzN, 2);  /* Number of binary digits in N */
+if(!iPrime16Initialized)vGenPrimes16();
+qMax=pmc->ulBits;  /* Number of binary digits in N */
 if(qMax < 36)qMax=36;
+if(qMax > 65521UL)qMax=65521UL;  /* Largest prime in ulPrime16[] */
+ulSqrtN=ULONG_MAX;
+if(pmc->ulBits < 36)
+  {
+  mpz_init(mpzSqrt);
+  mpz_sqrt(mpzSqrt, mpzN);
+  ulSqrtN=mpz_get_ui(mpzSqrt);
+  mpz_clear(mpzSqrt);
+  }
+pmc->iScreen=2;
 j=2;  /* First trial divisor is 3, the second prime */
 while(1)
   {
   q=ulPrime16[j++];
   if(q > qMax)break;
-  if(mpz_cmp_si(mpzN, q)==0)return(1);
-  if(mpz_cmp_si(mpzSqrt, q) < 0)return(1);
-  if(mpz_divisible_ui_p(mpzN, q))return(0);
+  if(mpz_cmp_si(mpzN, q)==0){pmc->iScreen=1; break;}
+  if(ulSqrtN < q){pmc->iScreen=1; break;}
+  if(mpz_divisible_ui_p(mpzN, q)){pmc->iScreen=0; break;}
   }
+return(pmc->iScreen);
+}
+/**********************************************************************/
+int iMillerCtx(mpz_t mpzN, long iB, struct __mpz_modctx *pmc)
+{
+/* Miller's test with base B, as in iMiller, but using the modulus
+   context pmc (created by __mpz_modctx_init for the same N) for the
+   values of d and s, the reductions in the squaring chain, and the
+   small prime screening, which is carried out only on the first call
+   for a given context. */
+
+mpz_t mpzB, mpzRem;
+long iComp2, j;
+unsigned long s;
+
+/* First take care of all N < 3 and all even N. */
+
+iComp2=mpz_cmp_si(mpzN, 2);
+if(iComp2 < 0)return(0);        /* N < 2 is by convention not prime */
+if(iComp2==0)return(1);         /* N=2 is prime */
+if(mpz_even_p(mpzN))return(0);  /* Even N > 2 is composite */
+
+/* Try small prime divisors (once per context). */
+
+if(iMillerScreen(mpzN, pmc) < 2)return(pmc->iScreen);
 
 /* Check for valid input. Miller's test requires B > 1, and N must not
    divide B exactly. Choose B=2 and B<--B+1 if these problems arise.
@@ -2621,20 +3991,22 @@ while(1)
    avoids the necessity of handling an error return of -1. */
 
 if(iB < 2)iB=2;
-mpz_set_si(mpzB, iB);
+mpz_init_set_si(mpzB, iB);
 if(mpz_divisible_p(mpzB, mpzN))mpz_add_ui(mpzB, mpzB, 1);
 
-/* Now compute d and s, where d is odd and N - 1 = (2^s)*d. */
+/* d and s, where d is odd and N - 1 = (2^s)*d, are in the context. */
 
-mpz_sub_ui(mpzNm1, mpzN, 1);
-s=mpz_scan1(mpzNm1, 0);
-mpz_tdiv_q_2exp(mpzd, mpzNm1, s);
+s=pmc->ulS;
 
 /* Now proceed with the Miller's algorithm. First, if B^d is
    congruent to 1 mod N, N is a strong probable prime to base B. */
 
-mpz_powm(mpzRem, mpzB, mpzd, mpzN);
-if(mpz_cmp_si(mpzRem, 1)==0)return(1);
+mpz_init2(mpzRem, 2*pmc->ulBits + mp_bits_per_limb);
+#undef RETURN
+#define RETURN(n) {mpz_clear(mpzB); mpz_clear(mpzRem); return(n);}
+
+__mpz_powm_ctx(mpzRem, mpzB, pmc->mpzd, pmc);
+if(mpz_cmp_si(mpzRem, 1)==0)RETURN(1);
 
 /* Now calculate B^((2^j)*d), for j=0,1,...,s-1 by successive
    squaring. If any of these is congruent to -1 mod N, N is a
@@ -2643,16 +4015,17 @@ if(mpz_cmp_si(mpzRem, 1)==0)return(1);
    modular exponentiation for speed (squaring is an order of
    magnitude faster). */
 
-if(mpz_cmp(mpzRem, mpzNm1)==0)return(1);  /* j=0 case */
+if(mpz_cmp(mpzRem, pmc->mpzNm1)==0)RETURN(1);  /* j=0 case */
 for(j=1; j < s; j++)
   {
   mpz_mul(mpzRem, mpzRem, mpzRem);
-  mpz_mod(mpzRem, mpzRem, mpzN);
-  if(mpz_cmp(mpzRem, mpzNm1)==0)return(1);
-  if(mpz_cmp(mpzRem, mpzOne)==0)return(0);
+  __mpz_mod_ctx(mpzRem, mpzRem, pmc);
+  if(mpz_cmp(mpzRem, pmc->mpzNm1)==0)RETURN(1);
+  if(mpz_cmp_si(mpzRem, 1)==0)RETURN(0);
+  if(pmc->piAbort && iAbortGet(pmc->piAbort))RETURN(0);
   }
 
-return(0);
+RETURN(0);
 }
 /**********************************************************************/
 int iBPSW(mpz_t mpzN)
@@ -2758,6 +4131,7 @@ int iBPSW(mpz_t mpzN)
  */
 
 int iComp2;
+struct __mpz_modctx mc;
 
 /* First eliminate all N < 3 and all even N. */
 
@@ -2769,7 +4143,17 @@ if(mpz_even_p(mpzN))return(0);
 /* Carry out Miller's test with base 2. This will also carry
    out a check for small prime divisors. */
 
-if(iMiller(mpzN, 2)==0)return(0);
+__mpz_modctx_init(&mc, mpzN);
+#undef RETURN
+#define RETURN(n) {__mpz_modctx_clear(&mc); return(n);}
+
+if((mc.ulBits >= PRP_PARALLEL_BITS) && (iPoolThreads(0) > 1))
+  {
+  iComp2=iPrPParallel(mpzN, 1, &mc);  /* both halves concurrently */
+  RETURN(iComp2);
+  }
+
+if(iMillerCtx(mpzN, 2, &mc)==0)RETURN(0);
 
 /* The rumored strategy of Mathematica could be imitated here by
  * performing additional Miller's tests. One could also carry out
@@ -2780,7 +4164,8 @@ if(iMiller(mpzN, 2)==0)return(0);
  * divisor < 37. Apply the strong Lucas-Selfridge primality test.
  */
 
-return(iStrongLucasSelfridge(mpzN));
+iComp2=iStrongLucasSelfridgeCtx(mpzN, &mc);
+RETURN(iComp2);
 }
 /**********************************************************************/
 int iLucasSelfridge(mpz_t mpzN)
@@ -2986,6 +4371,20 @@ int iStrongLucasSelfridge(mpz_t mpzN)
    indicating that the strong Lucas-Selfridge test is more computationally
    effective than the standard version. */
 
+struct __mpz_modctx mc;
+int iStat;
+
+__mpz_modctx_init(&mc, mpzN);
+iStat=iStrongLucasSelfridgeCtx(mpzN, &mc);
+__mpz_modctx_clear(&mc);
+return(iStat);
+}
+/**********************************************************************/
+int iStrongLucasSelfridgeCtx(mpz_t mpzN, struct __mpz_modctx *pmc)
+{
+/* The strong Lucas-Selfridge test, as in iStrongLucasSelfridge, with
+   the reductions mod N carried out through the modulus context pmc. */
+
 int iComp2, iP, iJ, iSign;
 long lDabs, lD, lQ;
 unsigned long ulMaxBits, uldbits, ul, ulGCD, r, s;
@@ -3150,14 +4549,15 @@ for(ul=1; ul < uldbits; ul++)  /* zero bit on, already accounted for */
  * V_2m = V_m*V_m - 2*Q^m
  */
   mpz_mul(mpzU2m, mpzU2m, mpzV2m);
-  mpz_mod(mpzU2m, mpzU2m, mpzN);
+  __mpz_mod_ctx(mpzU2m, mpzU2m, pmc);
   mpz_mul(mpzV2m, mpzV2m, mpzV2m);
   mpz_sub(mpzV2m, mpzV2m, mpz2Qm);
-  mpz_mod(mpzV2m, mpzV2m, mpzN);
+  __mpz_mod_ctx(mpzV2m, mpzV2m, pmc);
   /* Must calculate powers of Q for use in V_2m, also for Q^d later */
   mpz_mul(mpzQm, mpzQm, mpzQm);
-  mpz_mod(mpzQm, mpzQm, mpzN);  /* prevents overflow */
+  __mpz_mod_ctx(mpzQm, mpzQm, pmc);  /* prevents overflow */
   mpz_mul_2exp(mpz2Qm, mpzQm, 1);
+  if(pmc->piAbort && iAbortGet(pmc->piAbort))RETURN(0);
   if(mpz_tstbit(mpzd, ul))
     {
 /* Formulas for addition of indices (carried out mod N);
@@ -3178,10 +4578,10 @@ for(ul=1; ul < uldbits; ul++)  /* zero bit on, already accounted for */
     mpz_add(mpzV, mpzT3, mpzT4);
     if(mpz_odd_p(mpzV))mpz_add(mpzV, mpzV, mpzN);
     mpz_fdiv_q_2exp(mpzV, mpzV, 1);
-    mpz_mod(mpzU, mpzU, mpzN);
-    mpz_mod(mpzV, mpzV, mpzN);
+    __mpz_mod_ctx(mpzU, mpzU, pmc);
+    __mpz_mod_ctx(mpzV, mpzV, pmc);
     mpz_mul(mpzQkd, mpzQkd, mpzQm);  /* Calculating Q^d for later use */
-    mpz_mod(mpzQkd, mpzQkd, mpzN);
+    __mpz_mod_ctx(mpzQkd, mpzQkd, pmc);
     }
   }
 
@@ -3207,13 +4607,13 @@ for(r=1; r < s; r++)
   {
   mpz_mul(mpzV, mpzV, mpzV);
   mpz_sub(mpzV, mpzV, mpz2Qkd);
-  mpz_mod(mpzV, mpzV, mpzN);
+  __mpz_mod_ctx(mpzV, mpzV, pmc);
   if(mpz_sgn(mpzV)==0)RETURN(1);
 /* Calculate Q^{d*2^r} for next r (final iteration irrelevant). */
   if(r < s-1)
     {
     mpz_mul(mpzQkd, mpzQkd, mpzQkd);
-    mpz_mod(mpzQkd, mpzQkd, mpzN);
+    __mpz_mod_ctx(mpzQkd, mpzQkd, pmc);
     mpz_mul_2exp(mpz2Qkd, mpzQkd, 1);
     }
   }
@@ -3287,10 +4687,25 @@ int iExtraStrongLucas(mpz_t mpzN, long lB)
    Lucas-Selfridge BPSW tests, but the prospects do not look bright.
 */
 
-int iComp2, iJ;
-long lD, lP, lQ;
-unsigned long ulMaxBits, uldbits, ul, ulGCD, r, s;
-mpz_t mpzU, mpzV, mpzM, mpzU2m, mpzV2m, mpzT1, mpzT2, mpzT3, mpzT4,
+struct __mpz_modctx mc;
+int iStat;
+
+__mpz_modctx_init(&mc, mpzN);
+iStat=iExtraStrongLucasCtx(mpzN, lB, &mc);
+__mpz_modctx_clear(&mc);
+return(iStat);
+}
+/**********************************************************************/
+int iExtraStrongLucasCtx(mpz_t mpzN, long lB, struct __mpz_modctx *pmc)
+{
+/* The extra strong Lucas test with base B, as in iExtraStrongLucas,
+   with the reductions mod N carried out through the modulus context
+   pmc. */
+
+int iComp2, iJ;
+long lD, lP, lQ;
+unsigned long ulMaxBits, uldbits, ul, ulGCD, r, s;
+mpz_t mpzU, mpzV, mpzM, mpzU2m, mpzV2m, mpzT1, mpzT2, mpzT3, mpzT4,
       mpzD, mpzd, mpzTwo, mpzMinusTwo;
 
 #undef RETURN
@@ -3428,10 +4843,11 @@ for(ul=1; ul < uldbits; ul++)  /* zero bit on, already accounted for */
  * V_2m = V_m*V_m - 2*Q^m
  */
   mpz_mul(mpzU2m, mpzU2m, mpzV2m);
-  mpz_mod(mpzU2m, mpzU2m, mpzN);
+  __mpz_mod_ctx(mpzU2m, mpzU2m, pmc);
   mpz_mul(mpzV2m, mpzV2m, mpzV2m);
   mpz_sub_ui(mpzV2m, mpzV2m, 2);
-  mpz_mod(mpzV2m, mpzV2m, mpzN);
+  __mpz_mod_ctx(mpzV2m, mpzV2m, pmc);
+  if(pmc->piAbort && iAbortGet(pmc->piAbort))RETURN(0);
   if(mpz_tstbit(mpzd, ul))
     {
 /* Formulas for addition of indices (carried out mod N);
@@ -3452,8 +4868,8 @@ for(ul=1; ul < uldbits; ul++)  /* zero bit on, already accounted for */
     mpz_add(mpzV, mpzT3, mpzT4);
     if(mpz_odd_p(mpzV))mpz_add(mpzV, mpzV, mpzN);
     mpz_fdiv_q_2exp(mpzV, mpzV, 1);
-    mpz_mod(mpzU, mpzU, mpzN);
-    mpz_mod(mpzV, mpzV, mpzN);
+    __mpz_mod_ctx(mpzU, mpzU, pmc);
+    __mpz_mod_ctx(mpzV, mpzV, pmc);
     }
   }
 
@@ -3477,7 +4893,7 @@ for(r=1; r < s-1; r++)
   {
   mpz_mul(mpzV, mpzV, mpzV);
   mpz_sub_ui(mpzV, mpzV, 2);
-  mpz_mod(mpzV, mpzV, mpzN);
+  __mpz_mod_ctx(mpzV, mpzV, pmc);
   if(mpz_sgn(mpzV)==0)RETURN(1);
   }
 
@@ -3832,22 +5248,39 @@ return;
 /*          Analysis and processing of prime gap records              */
 /**********************************************************************/
 /**********************************************************************/
+static int iRecordValidP1(char *sz, void *pvP1);
+/**********************************************************************/
 int iRecordValidExt(char *sz)
 {
 /* Returns 0 for invalid record, 6 for a valid gap6 record, 9 for a
    valid gap9 record, 1 for a record of the form gggg pppp.
    Continuation lines return zero (invalid). Merit is not checked. */
 
+return(iRecordValidP1(sz, NULL));
+}
+/**********************************************************************/
+static int iRecordValidP1(char *sz, void *pvP1)
+{
+/* As iRecordValidExt; if pvP1 is not NULL (GMP only), it is an mpz_t
+   which receives the value of P1 of a type 1 record, as evaluated for
+   the plausibility test, so that it need not be parsed again (see
+   iGetGapRecObj). It is then read as cglp4 reads it, as a decimal
+   literal or else as an expression, after cutting it at the first
+   double space (a trailing comment), as iGetGapRecObj does; sz is
+   left unchanged. */
+
 #undef RETURN
-#define RETURN(n) {mpz_clear(mpzP1); return(n);}
+#define RETURN(n) {if(!pvP1)mpz_clear(mpzP1); return(n);}
 
 static char szTemp[41];
-char *ep;
+char *ep, *pch;
+int iErr;
 long sl;
 unsigned long ulMaxBits;
 double lf;
 #ifdef __GMP__
-  mpz_t mpzP1;
+  mpz_ptr mpzP1;
+  mpz_t mpzLocal;
 #endif
 
 if(strlen(sz) < 41)goto GAP1;
@@ -3904,10 +5337,24 @@ if((sl&1==1) && (sl != 1))return(0);
 ulMaxBits=ceil(1.4426950408889634*sl) + mp_bits_per_limb;
 if(ulMaxBits > __MAX_BITS__)ulMaxBits=__MAX_BITS__;
 
-mpz_init2(mpzP1, ulMaxBits);
-if(__mpz_set_str(mpzP1, ep, 0))
-  if(iEvalExprMPZ(mpzP1, ep))
-    RETURN(0);  /* unable to parse P1 */
+if(pvP1)
+  {
+  mpzP1=(mpz_ptr)pvP1;
+  while(isspace(*ep))ep++;
+  pch=strstr(ep, "  ");  /* cut off any comment, restored below */
+  if(pch)*pch=0;
+  iErr=mpz_set_str(mpzP1, ep, 10) && iEvalExprMPZ(mpzP1, ep);
+  if(pch)*pch=' ';
+  if(iErr)RETURN(0);  /* unable to parse P1 */
+  }
+else
+  {
+  mpzP1=mpzLocal;
+  mpz_init2(mpzP1, ulMaxBits);
+  if(__mpz_set_str(mpzP1, ep, 0))
+    if(iEvalExprMPZ(mpzP1, ep))
+      RETURN(0);  /* unable to parse P1 */
+  }
 
 /* The following plausibility test for P1 uses Nicely's observation
    that P1 > 0.122985*sqrt(g)*exp(sqrt(g)) for all first occurrence
@@ -3930,12 +5377,15 @@ return(1);
 #endif  /* __GMP__ */
 }
 /**********************************************************************/
+static unsigned long ulGapRecJoin(char *szGapRec, unsigned long ulLen,
+  char *pchSeg, char **ppchCont);
+/**********************************************************************/
 int iGetGapRecExt(char *szGapRec, FILE *fpIn)
 {
 /* Returns 0 for failure, 6 for successful gap6 record, 9 for successful
    gap8 record, 1 for gap1 record.  Terminating newline is removed. */
 
-char *pchCont, *pch;
+char *pchCont;
 int iStat;
 unsigned long ul;
 
@@ -3949,35 +5399,883 @@ szTrimTWS(szGapRec);
 iStat=iRecordValidExt(szGapRec);
 if(iStat < 2)return(iStat);
 
+/* Continuation lines are appended at the end of the record as
+   assembled so far (ul), and only the new segment is then scanned, so
+   that the time is linear in the length of the record (see
+   ulGapRecJoin). */
+
 pchCont=strpbrk(szGapRec+24, "_~\\");  /* Continuation lines coming? */
 if(pchCont)*pchCont=0;
+ul=pchCont ? pchCont - szGapRec : 0;
 while(pchCont)
   {
-  ul=strlen(szGapRec);
-  fgets(szGapRec+ul+1, __MAX_DIGITS__, fpIn);
+  fgets(szGapRec+ul+1, __MAX_DIGITS__ - ul - 1, fpIn);
   if(feof(fpIn))
     {
     szGapRec[0]=0;
     return(0);
     }
-  pch=szGapRec+ul+1;
-  while(*pch < 33)pch++;
-  strcat(szGapRec, pch);
-  szTrimTWS(szGapRec);
-  pchCont=strpbrk(szGapRec+24, "_~\\");  /* More continuation lines coming? */
-  if(pchCont)*pchCont=0;
+  ul=ulGapRecJoin(szGapRec, ul, szGapRec+ul+1, &pchCont);
   }
 return(iStat);
 }
 /**********************************************************************/
+static unsigned long ulGapRecJoin(char *szGapRec, unsigned long ulLen,
+  char *pchSeg, char **ppchCont)
+{
+/* Appends the continuation line pchSeg (which lies beyond the end of
+   the record) to the record szGapRec of length ulLen, less its leading
+   white space, then removes trailing white space and cuts the record
+   at the next continuation mark ('_', '~', or '\\'), if any, setting
+   *ppchCont to it (or NULL). Returns the new length. This is the
+   equivalent of strcat, szTrimTWS, and strpbrk on the whole record,
+   but only the new segment is scanned (the trimming may back up into
+   the earlier part, but each character is removed at most once). */
+
+unsigned long ulOld=ulLen, ulFrom;
+
+while(*pchSeg && (*pchSeg < 33))pchSeg++;
+ulLen += strlen(pchSeg);
+memmove(szGapRec + ulOld, pchSeg, ulLen - ulOld + 1);
+while((ulLen > 0) && !isgraph(szGapRec[ulLen-1]))szGapRec[--ulLen]=0;
+ulFrom=__MAX2(24, __MIN2(ulOld, ulLen));
+*ppchCont=(ulFrom < ulLen) ? strpbrk(szGapRec + ulFrom, "_~\\") : NULL;
+if(*ppchCont)
+  {
+  **ppchCont=0;
+  ulLen=*ppchCont - szGapRec;
+  }
+return(ulLen);
+}
+/**********************************************************************/
+static int iGapBinHeader(struct __gaplist *pgl, struct __gapbinhdr *phdr,
+  uint64_t ulFileSize)
+{
+/* Checks the header *phdr of a binary gap list of ulFileSize bytes,
+   and sets up pgl to read it. Returns 0 if it is valid, -1 if not. */
+
+if(memcmp(phdr->szMagic, __GAPBIN_MAGIC__, 8))return(-1);
+if(phdr->ulOrder != __GAPBIN_ORDER__)return(-1);
+if(phdr->ulVersion != __GAPBIN_VERSION__)return(-1);
+if((phdr->ulIdxOff < sizeof(struct __gapbinhdr)) || (phdr->ulIdxOff & 7)
+    || (phdr->ulIdxOff > ulFileSize)
+    || (phdr->nRec > (ulFileSize - phdr->ulIdxOff)/sizeof(struct __gapbinidx))
+    || (phdr->ulIdxOff + 2*phdr->nRec*sizeof(struct __gapbinidx)
+      != ulFileSize))
+  return(-1);
+pgl->iBinary=1;
+pgl->nRec=phdr->nRec;
+pgl->ulIdxOff=phdr->ulIdxOff;
+pgl->ulPos=sizeof(struct __gapbinhdr);
+return(0);
+}
+/**********************************************************************/
+struct __gaplist *pGapListOpen(char *szFile)
+{
+/* Opens the gap list szFile for reading by iGetGapRecView, returning
+   NULL on failure. Where mmap is supported (see __MMAP__ in trn.h),
+   the file is mapped read-only, and each line is found in place and
+   copied only into the record buffer szLine, so that the pages of the
+   mapping are never modified (they remain those of the file, to be
+   dropped by the system at need), and none are read before they are
+   needed; even a very large list is thus processed at once, in memory
+   bounded by __MAX_DIGITS__. Otherwise (or if the file is empty, or
+   cannot be mapped), it is read through a fully buffered stream. A
+   binary gap list (see pGapBinCreate) is recognized by its header,
+   and is returned as NULL if the header is not valid. */
+
+struct __gaplist *pgl;
+struct __gapbinhdr hdr;
+long lSize;
+#ifdef __MMAP__
+int fd;
+struct stat st;
+#endif
+
+pgl=(struct __gaplist *)calloc(1, sizeof(struct __gaplist));
+if(!pgl)return(NULL);
+pgl->szFile=(char *)malloc(strlen(szFile) + 1);
+if(!pgl->szFile)
+  {
+  free(pgl);
+  return(NULL);
+  }
+strcpy(pgl->szFile, szFile);
+pgl->szLine=(char *)malloc(__MAX_DIGITS__);
+if(!pgl->szLine)
+  {
+  vGapListClose(pgl);
+  return(NULL);
+  }
+
+#ifdef __MMAP__
+fd=open(szFile, O_RDONLY);
+if(fd < 0)
+  {
+  vGapListClose(pgl);
+  return(NULL);
+  }
+if((fstat(fd, &st)==0) && S_ISREG(st.st_mode) && (st.st_size > 0)
+    && ((uint64_t)st.st_size <= (size_t)-1))
+  {
+  pgl->pchMap=(char *)mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd,
+    0);
+  if(pgl->pchMap==(char *)MAP_FAILED)
+    pgl->pchMap=NULL;
+  else
+    {
+    pgl->ulSize=st.st_size;
+    madvise(pgl->pchMap, pgl->ulSize, MADV_SEQUENTIAL);
+    }
+  }
+close(fd);
+if(pgl->pchMap)
+  {
+  if((pgl->ulSize >= sizeof(hdr))
+    && !memcmp(pgl->pchMap, __GAPBIN_MAGIC__, 8))
+    {
+    memcpy(&hdr, pgl->pchMap, sizeof(hdr));
+    if(iGapBinHeader(pgl, &hdr, pgl->ulSize))
+      {
+      vGapListClose(pgl);
+      return(NULL);
+      }
+    }
+  return(pgl);
+  }
+#endif
+
+pgl->fp=fopen(szFile, "rb");
+if(!pgl->fp)
+  {
+  vGapListClose(pgl);
+  return(NULL);
+  }
+if((fread(&hdr, sizeof(hdr), 1, pgl->fp)==1)
+  && !memcmp(hdr.szMagic, __GAPBIN_MAGIC__, 8))
+  {
+  fseek(pgl->fp, 0, SEEK_END);
+  lSize=ftell(pgl->fp);
+  if((lSize < 0) || iGapBinHeader(pgl, &hdr, lSize))
+    {
+    vGapListClose(pgl);
+    return(NULL);
+    }
+  fseek(pgl->fp, pgl->ulPos, SEEK_SET);
+  }
+else
+  {
+  fclose(pgl->fp);  /* a text list, to be read in text mode */
+  pgl->fp=fopen(szFile, "rt");
+  if(!pgl->fp)
+    {
+    vGapListClose(pgl);
+    return(NULL);
+    }
+  }
+setvbuf(pgl->fp, NULL, _IOFBF, 1UL << 20);
+
+return(pgl);
+}
+/**********************************************************************/
+void vGapListClose(struct __gaplist *pgl)
+{
+/* Closes a gap list opened by pGapListOpen; the records it returned
+   are no longer valid. */
+
+if(!pgl)return;
+#ifdef __MMAP__
+if(pgl->pchMap)munmap(pgl->pchMap, pgl->ulSize);
+#endif
+if(pgl->fp)fclose(pgl->fp);
+free(pgl->szLine);
+free(pgl->szFile);
+free(pgl->pulSel);
+free(pgl);
+return;
+}
+/**********************************************************************/
+static int iGapBinIdxCmpGap(const void *pv1, const void *pv2)
+{
+const struct __gapbinidx *p1=pv1, *p2=pv2;
+
+if(p1->ulGap != p2->ulGap)return((p1->ulGap < p2->ulGap) ? -1 : 1);
+if(p1->ulOff != p2->ulOff)return((p1->ulOff < p2->ulOff) ? -1 : 1);
+return(0);
+}
+/**********************************************************************/
+static int iGapBinIdxCmpD1(const void *pv1, const void *pv2)
+{
+const struct __gapbinidx *p1=pv1, *p2=pv2;
+
+if(p1->ulD1 != p2->ulD1)return((p1->ulD1 < p2->ulD1) ? -1 : 1);
+if(p1->ulOff != p2->ulOff)return((p1->ulOff < p2->ulOff) ? -1 : 1);
+return(0);
+}
+/**********************************************************************/
+static int iOffsetCmp(const void *pv1, const void *pv2)
+{
+size_t ul1=*(const size_t *)pv1, ul2=*(const size_t *)pv2;
+
+return((ul1 < ul2) ? -1 : (ul1 > ul2));
+}
+/**********************************************************************/
+static size_t ulGapBinIdxBound(struct __gapbinidx *pIdx, size_t n,
+  int iD1, unsigned long ulKey)
+{
+/* Returns the number of entries of the index pIdx[0..n-1], sorted by
+   gap (or by digits, if iD1 is nonzero), with keys less than ulKey. */
+
+size_t ulLo=0, ulHi=n, ulMid;
+
+while(ulLo < ulHi)
+  {
+  ulMid=ulLo + (ulHi - ulLo)/2;
+  if((iD1 ? pIdx[ulMid].ulD1 : pIdx[ulMid].ulGap) < ulKey)
+    ulLo=ulMid + 1;
+  else
+    ulHi=ulMid;
+  }
+return(ulLo);
+}
+/**********************************************************************/
+#ifdef __GMP__
+static struct __gapbinidx *pGapIdxSidecar(char *szFile, size_t *pn);
+#endif
+/**********************************************************************/
+long lGapListSelect(struct __gaplist *pgl, unsigned long ulMinGap,
+  unsigned long ulMaxGap, unsigned long ulMinDigits,
+  unsigned long ulMaxDigits)
+{
+/* Restricts the records subsequently returned from the gap list pgl
+   to those with ulMinGap <= gap <= ulMaxGap and ulMinDigits <= digits
+   <= ulMaxDigits, still in file order, using the index of a binary gap
+   list, or else the sidecar index of a text list (see struct
+   __gapidxhdr in trn.h), which is built (and saved, if possible) if it
+   is missing or out of date; building it costs one full reading of
+   the list (GMP only). Of the two index ranges so selected, the
+   smaller is scanned, and those records outside the other range are
+   discarded; the result is correct whatever the order of the list.
+   Returns the number of records selected, or -1 if the list has no
+   index (it is then read in full) or on failure. Should be called
+   before the first record is read. */
+
+struct __gapbinidx *pIdx=NULL, *pIdxAlloc=NULL;
+size_t ulGap0, ulGap1, ulD10, ulD11, ul, n;
+int iD1;
+
+if(!pgl->iBinary)
+  {
+#ifdef __GMP__
+  pIdxAlloc=pGapIdxSidecar(pgl->szFile, &n);
+  if(!pIdxAlloc)return(-1);
+  pIdx=pIdxAlloc;
+#else
+  return(-1);
+#endif
+  }
+else if(pgl->nRec > (size_t)-1/(2*sizeof(struct __gapbinidx)))
+  return(-1);
+else if(pgl->pchMap)
+  {
+  n=pgl->nRec;
+  pIdx=(struct __gapbinidx *)(pgl->pchMap + pgl->ulIdxOff);
+  }
+else
+  {
+  n=pgl->nRec;
+  pIdxAlloc=(struct __gapbinidx *)malloc(2*n*sizeof(struct __gapbinidx)
+    + 1);
+  if(!pIdxAlloc)return(-1);
+  if(fseek(pgl->fp, pgl->ulIdxOff, SEEK_SET)
+      || (fread(pIdxAlloc, sizeof(struct __gapbinidx), 2*n, pgl->fp) != 2*n))
+    {
+    free(pIdxAlloc);
+    fseek(pgl->fp, pgl->ulPos, SEEK_SET);
+    return(-1);
+    }
+  pIdx=pIdxAlloc;
+  }
+
+free(pgl->pulSel);
+pgl->pulSel=(size_t *)malloc(n*sizeof(size_t) + 1);
+pgl->nSel=pgl->iSel=0;
+if(!pgl->pulSel)
+  {
+  free(pIdxAlloc);
+  return(-1);
+  }
+
+ulGap0=ulGapBinIdxBound(pIdx, n, 0, ulMinGap);
+ulGap1=(ulMaxGap >= 0xFFFFFFFFUL) ? n :
+  ulGapBinIdxBound(pIdx, n, 0, ulMaxGap + 1);
+ulD10=ulGapBinIdxBound(pIdx + n, n, 1, ulMinDigits);
+ulD11=(ulMaxDigits >= 0xFFFFFFFFUL) ? n :
+  ulGapBinIdxBound(pIdx + n, n, 1, ulMaxDigits + 1);
+iD1=(ulGap1 < ulGap0) || (ulD11 < ulD10)
+  || (ulD11 - ulD10 < ulGap1 - ulGap0);
+if(!iD1)
+  {
+  for(ul=ulGap0; ul < ulGap1; ul++)
+    if((pIdx[ul].ulD1 >= ulMinDigits) && (pIdx[ul].ulD1 <= ulMaxDigits))
+      pgl->pulSel[pgl->nSel++]=pIdx[ul].ulOff;
+  }
+else
+  {
+  for(ul=n + ulD10; ul < n + ulD11; ul++)
+    if((pIdx[ul].ulGap >= ulMinGap) && (pIdx[ul].ulGap <= ulMaxGap))
+      pgl->pulSel[pgl->nSel++]=pIdx[ul].ulOff;
+  }
+qsort(pgl->pulSel, pgl->nSel, sizeof(size_t), iOffsetCmp);
+free(pIdxAlloc);
+return((long)pgl->nSel);
+}
+/**********************************************************************/
+static char *pchGapListLine(struct __gaplist *pgl, char *pchDest)
+{
+/* Returns the next line of the gap list, without its newline, or NULL
+   at the end of the file, stored at pchDest (within szLine), or at
+   szLine if pchDest is NULL. A mapped line is found in place (its
+   pointer and length) and then copied; the mapping is never written.
+   As with fgets, a line too long for the room left is split. */
+
+char *pch, *pchEnd;
+size_t ul, ulLen;
+
+if(!pchDest)pchDest=pgl->szLine;
+ul=__MAX_DIGITS__ - (pchDest - pgl->szLine);
+if(ul < 2)return(NULL);
+
+if(pgl->pchMap)
+  {
+  if(pgl->ulPos >= pgl->ulSize)return(NULL);
+  pch=pgl->pchMap + pgl->ulPos;
+  ulLen=__MIN2(pgl->ulSize - pgl->ulPos, ul - 1);
+  pchEnd=(char *)memchr(pch, '\n', ulLen);
+  if(pchEnd)
+    {
+    ulLen=pchEnd - pch;
+    pgl->ulPos++;
+    }
+  memcpy(pchDest, pch, ulLen);
+  pchDest[ulLen]=0;
+  pgl->ulPos += ulLen;
+  return(pchDest);
+  }
+
+if(!fgets(pchDest, ul, pgl->fp))return(NULL);
+pchEnd=strchr(pchDest, '\n');
+if(pchEnd)*pchEnd=0;
+return(pchDest);
+}
+/**********************************************************************/
+static int iGapBinRec(struct __gaplist *pgl, char **ppchRec,
+  struct __gapbinrec *pbr, void *pvP1)
+{
+/* Reads the next record (or the next selected record; see
+   lGapListSelect) of a binary gap list into *pbr, setting *ppchRec to
+   its text, in szLine (copied there from the mapping, which is
+   read-only, if the list is mapped). If pvP1 is not NULL (GMP
+   only), it is an mpz_t which receives P1. Returns -1 at the end of the
+   list (or at a damaged record), and otherwise the type of the
+   record. A mapped P1 is converted by mpz_import directly from the
+   mapping, the format of mpz_out_raw being a 4-byte big-endian count
+   of bytes followed by the magnitude, big-endian. */
+
+uint64_t ulOff;
+unsigned char *puch, uch[4];
+uint32_t ulBytes;
+
+if(pgl->pulSel)
+  {
+  if(pgl->iSel >= pgl->nSel)return(-1);
+  ulOff=pgl->pulSel[pgl->iSel++];
+  if(!pgl->pchMap && fseek(pgl->fp, ulOff, SEEK_SET))return(-1);
+  }
+else
+  ulOff=pgl->ulPos;
+if(ulOff + sizeof(struct __gapbinrec) + 5 > pgl->ulIdxOff)return(-1);
+
+if(pgl->pchMap)
+  {
+  memcpy(pbr, pgl->pchMap + ulOff, sizeof(struct __gapbinrec));
+  ulOff += sizeof(struct __gapbinrec);
+  if((pbr->ulLen > pgl->ulIdxOff - ulOff - 5)
+      || (pbr->ulLen >= __MAX_DIGITS__) || (pbr->ulP1Off > pbr->ulLen))
+    return(-1);
+  memcpy(pgl->szLine, pgl->pchMap + ulOff, pbr->ulLen);
+  pgl->szLine[pbr->ulLen]=0;
+  *ppchRec=pgl->szLine;
+  ulOff += pbr->ulLen + 1;
+  puch=(unsigned char *)pgl->pchMap + ulOff;
+  ulBytes=((uint32_t)puch[0] << 24) | ((uint32_t)puch[1] << 16)
+    | ((uint32_t)puch[2] << 8) | puch[3];
+  ulOff += 4;
+  if(ulBytes > pgl->ulIdxOff - ulOff)return(-1);  /* also if P1 < 0 */
+#ifdef __GMP__
+  if(pvP1)mpz_import((mpz_ptr)pvP1, ulBytes, 1, 1, 0, 0, puch + 4);
+#endif
+  pgl->ulPos=ulOff + ulBytes;
+  return(pbr->iType);
+  }
+
+if(fread(pbr, sizeof(struct __gapbinrec), 1, pgl->fp) != 1)return(-1);
+if((pbr->ulLen >= __MAX_DIGITS__) || (pbr->ulP1Off > pbr->ulLen))
+  return(-1);
+if(fread(pgl->szLine, 1, pbr->ulLen + 1, pgl->fp) != pbr->ulLen + 1)
+  return(-1);
+pgl->szLine[pbr->ulLen]=0;
+*ppchRec=pgl->szLine;
+#ifdef __GMP__
+if(pvP1)
+  {
+  if(!mpz_inp_raw((mpz_ptr)pvP1, pgl->fp))return(-1);
+  }
+else
+#endif
+  {
+  if(fread(uch, 1, 4, pgl->fp) != 4)return(-1);
+  ulBytes=((uint32_t)uch[0] << 24) | ((uint32_t)uch[1] << 16)
+    | ((uint32_t)uch[2] << 8) | uch[3];
+  if(fseek(pgl->fp, ulBytes, SEEK_CUR))return(-1);
+  }
+pgl->ulPos=ftell(pgl->fp);
+return(pbr->iType);
+}
+/**********************************************************************/
+static int iGapListRec(struct __gaplist *pgl, char **ppchRec,
+  void *pvP1);
+/**********************************************************************/
+int iGetGapRecView(struct __gaplist *pgl, char **ppchRec)
+{
+/* As iGetGapRecExt, but for a gap list opened by pGapListOpen: *ppchRec
+   is set to the record, within the buffer of the list (see
+   pGapListOpen), with trailing white space removed and continuation
+   lines joined, each continuation segment being moved down to the end
+   of the preceding one. The record remains valid until the next call.
+   Returns -1 at the end of the file, and otherwise as iGetGapRecExt. */
+
+return(iGapListRec(pgl, ppchRec, NULL));
+}
+/**********************************************************************/
+static int iGapListRec(struct __gaplist *pgl, char **ppchRec,
+  void *pvP1)
+{
+/* As iGetGapRecView; pvP1 is passed to iRecordValidP1. */
+
+char *pchRec, *pchCont, *pch;
+size_t ul;
+int iStat;
+struct __gapbinrec br;
+
+if(pgl->iBinary)return(iGapBinRec(pgl, ppchRec, &br, NULL));
+
+if(pgl->pulSel)  /* the next selected record (see lGapListSelect) */
+  {
+  if(pgl->iSel >= pgl->nSel)return(-1);
+  if(pgl->pchMap)
+    pgl->ulPos=pgl->pulSel[pgl->iSel++];
+  else if(fseek(pgl->fp, pgl->pulSel[pgl->iSel++], SEEK_SET))
+    return(-1);
+  }
+
+pchRec=pchGapListLine(pgl, NULL);
+if(!pchRec)return(-1);
+*ppchRec=pchRec;
+szTrimTWS(pchRec);
+iStat=iRecordValidP1(pchRec, pvP1);
+if(iStat < 2)return(iStat);
+
+pchCont=strpbrk(pchRec+24, "_~\\");  /* Continuation lines coming? */
+if(pchCont)*pchCont=0;
+ul=pchCont ? pchCont - pchRec : 0;
+while(pchCont)
+  {
+  pch=pchGapListLine(pgl, pchRec + ul + 1);
+  if(!pch)
+    {
+    pchRec[0]=0;
+    return(-1);
+    }
+  ul=ulGapRecJoin(pchRec, ul, pch, &pchCont);
+  }
+return(iStat);
+}
+#ifdef __GMP__
+/**********************************************************************/
+void vGapRecInit(struct __gaprec *pgr)
+{
+memset(pgr, 0, sizeof(struct __gaprec));
+mpz_init(pgr->mpzP1);
+return;
+}
+/**********************************************************************/
+void vGapRecClear(struct __gaprec *pgr)
+{
+mpz_clear(pgr->mpzP1);
+return;
+}
+/**********************************************************************/
+int iGetGapRecObj(struct __gaplist *pgl, struct __gaprec *pgr)
+{
+/* Reads the next record of the gap list pgl (see iGetGapRecView) into
+   *pgr, parsing it once: the gap measure, the position of P1, and the
+   number of digits in P1 (as stated in a gap6 or gap9 record). A type
+   1 record states no digits, and its P1 has already been evaluated in
+   validating it (see iRecordValidP1); that value is kept in mpzP1, and
+   ulD1 counted from it. The P1 of a gap6 or gap9 record is left to
+   iGapRecP1, so that it need only be evaluated if the record is not
+   rejected on its other fields. A type 1 P1 is cut at the first double
+   space (a trailing comment). Returns -1 at the end of the file, 0 for
+   an invalid record (which is to be skipped), and otherwise the type
+   of the record, as iGetGapRecExt. */
+
+char *ep, *pch;
+long lG;
+int iStat;
+struct __gapbinrec br;
+
+pgr->iP1=0;
+if(pgl->iBinary)  /* already parsed and evaluated */
+  {
+  iStat=iGapBinRec(pgl, &pgr->szRec, &br, pgr->mpzP1);
+  pgr->iType=iStat;
+  if(iStat <= 0)return(-1);
+  pgr->ulGap=br.ulGap;
+  pgr->ulD1=br.ulD1;
+  pgr->szP1=pgr->szRec + br.ulP1Off;
+  pgr->iP1=1;
+  return(iStat);
+  }
+iStat=iGapListRec(pgl, &pgr->szRec, pgr->mpzP1);
+pgr->iType=iStat;
+if(iStat <= 0)return(iStat);
+lG=atol(pgr->szRec);  /* Check for valid gap measure lG */
+if(lG <= 0)return(0);
+if((lG & 1) && (lG != 1))return(0);
+pgr->ulGap=strtoul(pgr->szRec, &ep, 10);
+if((pgr->ulGap != lG) || (pgr->ulGap > 999999999UL))return(0);
+if(iStat==6)
+  {
+  pgr->ulD1=strtoul(pgr->szRec+32, NULL, 10);
+  pgr->szP1=pgr->szRec+40;
+  }
+else if(iStat==9)
+  {
+  pgr->ulD1=strtoul(pgr->szRec+37, NULL, 10);
+  pgr->szP1=pgr->szRec+47;
+  }
+else if(iStat==1)
+  {
+  szTrimMWS(ep);
+  pch=strstr(ep, "  ");
+  if(pch)*pch=0;
+  szTrimMWS(ep);
+  pgr->szP1=ep;
+  pgr->iP1=1;
+  pgr->ulD1=__mpz_ndigits10(pgr->mpzP1);
+  }
+else
+  return(0);
+return(iStat);
+}
+/**********************************************************************/
+int iGapRecP1(struct __gaprec *pgr)
+{
+/* Evaluates P1 of the record read by iGetGapRecObj into mpzP1, if it
+   has not been already, as a decimal literal or else as an expression.
+   Returns zero if successful, nonzero if P1 cannot be parsed. */
+
+if(pgr->iP1==0)
+  {
+  pgr->iP1=1;
+  if(mpz_set_str(pgr->mpzP1, pgr->szP1, 10))
+    if(iEvalExprMPZ(pgr->mpzP1, pgr->szP1))
+      pgr->iP1=-1;
+  }
+return(pgr->iP1 < 0);
+}
+/**********************************************************************/
+static struct __gapbinidx *pGapIdxBuild(char *szFile, size_t *pn)
+{
+/* Reads the text gap list szFile in full, returning its index (2n
+   entries, as in a binary gap list) and setting *pn to n, the number
+   of valid records, or returning NULL on failure. The list is opened
+   anew for the purpose. */
+
+struct __gaplist *pgl;
+struct __gaprec gr;
+struct __gapbinidx *pIdx=NULL, *p;
+size_t n=0, nMax=0;
+uint64_t ulOff;
+int iStat;
+
+pgl=pGapListOpen(szFile);
+if(!pgl)return(NULL);
+if(pgl->iBinary)
+  {
+  vGapListClose(pgl);
+  return(NULL);
+  }
+vGapRecInit(&gr);
+while(1)
+  {
+  ulOff=pgl->pchMap ? pgl->ulPos : ftell(pgl->fp);
+  iStat=iGetGapRecObj(pgl, &gr);
+  if(iStat < 0)break;
+  if(!iStat)continue;
+  if(n==nMax)
+    {
+    p=(struct __gapbinidx *)realloc(pIdx,
+      (2*nMax + 1024)*sizeof(struct __gapbinidx));
+    if(!p)
+      {
+      free(pIdx);
+      pIdx=NULL;
+      break;
+      }
+    pIdx=p;
+    nMax=2*nMax + 1024;
+    }
+  pIdx[n].ulGap=gr.ulGap;
+  pIdx[n].ulD1=(gr.ulD1 > 0xFFFFFFFFUL) ? 0xFFFFFFFFUL : gr.ulD1;
+  pIdx[n].ulOff=ulOff;
+  n++;
+  }
+vGapRecClear(&gr);
+vGapListClose(pgl);
+if(!pIdx && n)return(NULL);
+
+p=(struct __gapbinidx *)realloc(pIdx, 2*n*sizeof(struct __gapbinidx) + 1);
+if(!p)
+  {
+  free(pIdx);
+  return(NULL);
+  }
+pIdx=p;
+if(n)memcpy(pIdx + n, pIdx, n*sizeof(struct __gapbinidx));
+qsort(pIdx, n, sizeof(struct __gapbinidx), iGapBinIdxCmpGap);
+qsort(pIdx + n, n, sizeof(struct __gapbinidx), iGapBinIdxCmpD1);
+*pn=n;
+return(pIdx);
+}
+/**********************************************************************/
+static struct __gapbinidx *pGapIdxSidecar(char *szFile, size_t *pn)
+{
+/* Returns the index of the text gap list szFile (2n entries, as in a
+   binary gap list), setting *pn to n, or NULL on failure. The index is
+   read from the sidecar file szFile.gix, if that matches the list, and
+   is otherwise built by pGapIdxBuild and saved there (if the sidecar
+   cannot be written, the index is still used for this run). The
+   sidecar is written as szFile.gix.<pid> and renamed into place, so
+   that another run never reads it half written. */
+
+struct stat st;
+struct __gapidxhdr hdr;
+struct __gapbinidx *pIdx=NULL;
+char *szIdx, *szTmp;
+FILE *fp;
+long lSize;
+int64_t lNsec=0;
+size_t n=0;
+
+if(stat(szFile, &st))return(NULL);
+#if defined(__LINUX__) || defined(__CYGWIN__)
+lNsec=st.st_mtim.tv_nsec;
+#endif
+szIdx=(char *)malloc(2*strlen(szFile) + 40);
+if(!szIdx)return(NULL);
+sprintf(szIdx, "%s.gix", szFile);
+szTmp=szIdx + strlen(szIdx) + 1;
+#if !defined(__DMC__) && !defined(__BORLANDC__)
+sprintf(szTmp, "%s.gix.%lu", szFile, (unsigned long)getpid());
+#else
+sprintf(szTmp, "%s.gix.tmp", szFile);
+#endif
+
+fp=fopen(szIdx, "rb");
+if(fp)
+  {
+  fseek(fp, 0, SEEK_END);
+  lSize=ftell(fp);
+  rewind(fp);
+  if((fread(&hdr, sizeof(hdr), 1, fp)==1)
+      && !memcmp(hdr.szMagic, __GAPIDX_MAGIC__, 8)
+      && (hdr.ulOrder==__GAPBIN_ORDER__)
+      && (hdr.ulVersion==__GAPIDX_VERSION__)
+      && (hdr.ulListSize==(uint64_t)st.st_size)
+      && (hdr.lListTime==(int64_t)st.st_mtime)
+      && (hdr.lListNsec==lNsec)
+      && (hdr.ulListIno==(uint64_t)st.st_ino)
+      && (lSize >= (long)sizeof(hdr))
+      && (hdr.nRec <= (lSize - sizeof(hdr))/(2*sizeof(struct __gapbinidx)))
+      && (sizeof(hdr) + 2*hdr.nRec*sizeof(struct __gapbinidx)==lSize))
+    {
+    n=hdr.nRec;
+    pIdx=(struct __gapbinidx *)malloc(2*n*sizeof(struct __gapbinidx) + 1);
+    if(pIdx
+	&& (fread(pIdx, sizeof(struct __gapbinidx), 2*n, fp) != 2*n))
+      {
+      free(pIdx);
+      pIdx=NULL;
+      }
+    }
+  fclose(fp);
+  }
+
+if(!pIdx)
+  {
+  pIdx=pGapIdxBuild(szFile, &n);
+  if(pIdx)
+    {
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.szMagic, __GAPIDX_MAGIC__, 8);
+    hdr.ulOrder=__GAPBIN_ORDER__;
+    hdr.ulVersion=__GAPIDX_VERSION__;
+    hdr.nRec=n;
+    hdr.ulListSize=st.st_size;
+    hdr.lListTime=st.st_mtime;
+    hdr.lListNsec=lNsec;
+    hdr.ulListIno=st.st_ino;
+    fp=fopen(szTmp, "wb");
+    if(fp)
+      {
+      fwrite(&hdr, sizeof(hdr), 1, fp);
+      fwrite(pIdx, sizeof(struct __gapbinidx), 2*n, fp);
+      if(fclose(fp))
+	remove(szTmp);  /* a partial index is never used */
+      else
+	{
+#if !defined(__LINUX__) && !defined(__CYGWIN__)
+	remove(szIdx);  /* rename does not replace a file under DOS */
+#endif
+	if(rename(szTmp, szIdx))remove(szTmp);
+	}
+      }
+    }
+  }
+free(szIdx);
+*pn=n;
+return(pIdx);
+}
+/**********************************************************************/
+struct __gapbinout *pGapBinCreate(char *szFile)
+{
+/* Creates the binary gap list szFile (see struct __gapbinhdr in trn.h),
+   to be written by iGapBinWrite and completed by iGapBinClose. Returns
+   NULL on failure. The header is written (with no records) at once,
+   and again with the counts by iGapBinClose. */
+
+struct __gapbinout *pgbo;
+struct __gapbinhdr hdr;
+
+pgbo=(struct __gapbinout *)calloc(1, sizeof(struct __gapbinout));
+if(!pgbo)return(NULL);
+pgbo->fp=fopen(szFile, "wb");
+if(!pgbo->fp)
+  {
+  free(pgbo);
+  return(NULL);
+  }
+setvbuf(pgbo->fp, NULL, _IOFBF, 1UL << 20);
+memset(&hdr, 0, sizeof(hdr));
+memcpy(hdr.szMagic, __GAPBIN_MAGIC__, 8);
+hdr.ulOrder=__GAPBIN_ORDER__;
+hdr.ulVersion=__GAPBIN_VERSION__;
+fwrite(&hdr, sizeof(hdr), 1, pgbo->fp);
+pgbo->ulPos=sizeof(hdr);
+return(pgbo);
+}
+/**********************************************************************/
+int iGapBinWrite(struct __gapbinout *pgbo, char *szRec, char *szP1,
+  int iType, unsigned long ulGap, unsigned long ulD1, mpz_t mpzP1)
+{
+/* Appends a record to the binary gap list pgbo: its text szRec, the
+   position of P1 (szP1, within szRec), and its type, gap, digits, and
+   value of P1 (which must be positive), as found by iGetGapRecObj
+   and verified by the caller. Returns 0 if successful, -1 if not. */
+
+struct __gapbinrec br;
+struct __gapbinidx *pIdx;
+size_t ulBytes;
+
+if(mpz_sgn(mpzP1) <= 0)return(-1);
+br.ulGap=ulGap;
+br.ulD1=ulD1;
+br.iType=iType;
+br.ulP1Off=szP1 - szRec;
+br.ulLen=strlen(szRec);
+if(pgbo->nRec==pgbo->nMax)
+  {
+  pIdx=(struct __gapbinidx *)realloc(pgbo->pIdx,
+    (2*pgbo->nMax + 1024)*sizeof(struct __gapbinidx));
+  if(!pIdx)return(-1);
+  pgbo->pIdx=pIdx;
+  pgbo->nMax=2*pgbo->nMax + 1024;
+  }
+pIdx=pgbo->pIdx + pgbo->nRec;
+pIdx->ulGap=ulGap;
+pIdx->ulD1=ulD1;
+pIdx->ulOff=pgbo->ulPos;
+if(fwrite(&br, sizeof(br), 1, pgbo->fp) != 1)return(-1);
+if(fwrite(szRec, 1, br.ulLen + 1, pgbo->fp) != br.ulLen + 1)return(-1);
+ulBytes=mpz_out_raw(pgbo->fp, mpzP1);
+if(!ulBytes)return(-1);
+pgbo->ulPos += sizeof(br) + br.ulLen + 1 + ulBytes;
+pgbo->nRec++;
+return(0);
+}
+/**********************************************************************/
+int iGapBinClose(struct __gapbinout *pgbo)
+{
+/* Completes and closes the binary gap list pgbo, writing its index
+   (sorted by gap, then by digits, the records of equal keys in file
+   order) and its header. Returns 0 if successful, -1 if not. */
+
+static char szPad[8];
+struct __gapbinhdr hdr;
+size_t n=pgbo->nRec;
+int iRet=0;
+
+if(pgbo->ulPos & 7)
+  {
+  fwrite(szPad, 1, 8 - (pgbo->ulPos & 7), pgbo->fp);
+  pgbo->ulPos += 8 - (pgbo->ulPos & 7);
+  }
+if(n)
+  {
+  qsort(pgbo->pIdx, n, sizeof(struct __gapbinidx), iGapBinIdxCmpGap);
+  if(fwrite(pgbo->pIdx, sizeof(struct __gapbinidx), n, pgbo->fp) != n)
+    iRet=-1;
+  qsort(pgbo->pIdx, n, sizeof(struct __gapbinidx), iGapBinIdxCmpD1);
+  if(fwrite(pgbo->pIdx, sizeof(struct __gapbinidx), n, pgbo->fp) != n)
+    iRet=-1;
+  }
+memset(&hdr, 0, sizeof(hdr));
+memcpy(hdr.szMagic, __GAPBIN_MAGIC__, 8);
+hdr.ulOrder=__GAPBIN_ORDER__;
+hdr.ulVersion=__GAPBIN_VERSION__;
+hdr.nRec=n;
+hdr.ulIdxOff=pgbo->ulPos;
+if(fseek(pgbo->fp, 0, SEEK_SET)
+    || (fwrite(&hdr, sizeof(hdr), 1, pgbo->fp) != 1))
+  iRet=-1;
+if(fclose(pgbo->fp))iRet=-1;
+free(pgbo->pIdx);
+free(pgbo);
+return(iRet);
+}
+#endif  /* __GMP__ */
+/**********************************************************************/
 void vGapContExt(char *szContRec, char *szGapRec)
 {
 /* Creates a line continued gap6 or gap9 structure, or NULL on failure.
    NOTE: No terminating newline is appended. */
 
 static char szSpacer[48];
+char *pch;
 int iStat;
-unsigned long ulLen, ulOffset=40, ul;
+unsigned long ulLen, ulOffset=40, ul, ulIndent;
 
 iStat=iRecordValidExt(szGapRec);
 if(iStat==0)
@@ -3999,17 +6297,21 @@ if(ulLen <= ulOffset + 200)
   }
 
 strncpy(szContRec, szGapRec, ulOffset);
-szContRec[ulOffset]=0;
-for(ul=0; ul < ulOffset; ul++)szSpacer[ul]=' ';
-szSpacer[ulOffset]=0;
+ulIndent=ulOffset;
+for(ul=0; ul < ulIndent; ul++)szSpacer[ul]=' ';
+pch=szContRec + ulOffset;  /* end of the output so far */
 while(1)
   {
-  strncat(szContRec, szGapRec + ulOffset, 200);
+  ul=__MIN2(200, ulLen - ulOffset);
+  memcpy(pch, szGapRec + ulOffset, ul);
+  pch += ul;
   ulOffset += 200;
   if(ulOffset >= ulLen)break;
-  strcat(szContRec, "\\\n");
-  strcat(szContRec, szSpacer);
+  memcpy(pch, "\\\n", 2);
+  memcpy(pch + 2, szSpacer, ulIndent);
+  pch += 2 + ulIndent;
   }
+*pch=0;
 return;
 }
 /**********************************************************************/
@@ -4021,6 +6323,7 @@ int iGetGapRec(char *szGapRec, FILE *fpIn)
 static int iInit=0;
 static char *szIn;
 char *pchCont;
+unsigned long ul, ul2;
 
 if(!iInit)
   {
@@ -4046,6 +6349,7 @@ szTrimTWS(szIn);
 pchCont=strpbrk(szIn+24, "_~\\");  /* Continuation lines coming? */
 if(pchCont)*pchCont=0;
 strcpy(szGapRec, szIn);
+ul=strlen(szGapRec);  /* appended at ul, not by strcat (linear time) */
 while(pchCont)
   {
   fgets(szIn, 32000, fpIn);
@@ -4053,7 +6357,9 @@ while(pchCont)
   szTrimTWS(szIn);
   pchCont=strpbrk(szIn+24, "_~\\");  /* More continuation lines coming? */
   if(pchCont)*pchCont=0;
-  strcat(szGapRec, szIn+40);
+  ul2=strlen(szIn+40);
+  memcpy(szGapRec+ul, szIn+40, ul2+1);
+  ul += ul2;
   }
 return(1);
 }
@@ -4268,54 +6574,404 @@ double lfPMA(void)
     }
   MEMORYSTATUSEX, *LPMEMORYSTATUSEX;
 
-  MEMORYSTATUS mstMemStat;
-  MEMORYSTATUSEX mstMemStatEx;
-  HANDLE hModule;
-  FARPROC GMSX;
+  MEMORYSTATUS mstMemStat;
+  MEMORYSTATUSEX mstMemStatEx;
+  HANDLE hModule;
+  FARPROC GMSX;
+
+  mstMemStatEx.dwLength = sizeof(mstMemStatEx);
+  hModule=LoadLibrary("kernel32.dll");
+  if(hModule)
+    {
+    GMSX=GetProcAddress(hModule, "GlobalMemoryStatusEx");
+    if(GMSX)
+      {
+      GMSX(&mstMemStatEx);
+      return((double)mstMemStatEx.ullAvailPhys);
+      }
+    }
+
+  /* If we arrive here, the LoadLibrary and/or GetProcAddress
+     calls have failed. Default to the old GlobalMemoryStatus
+     routine. */
+
+  mstMemStat.dwLength = sizeof(mstMemStat);
+  GlobalMemoryStatus(&mstMemStat);
+  return((double)mstMemStat.dwAvailPhys);
+
+  #endif  /* Borland C 5.00+ */
+
+#else
+
+  return(-1.0);
+
+#endif
+}
+/***********************************************************************/
+int iSignum(long double ldArg)
+{
+if(ldArg==0)return(0);
+return((ldArg > 0) ? +1 : -1);
+}
+/**********************************************************************/
+/*            Buffered log (a results file, one writer)               */
+/**********************************************************************/
+static struct __logsink *plsLog=NULL;  /* open logs, for vFlush etc. */
+static void (*pfnLogSigInt)(int), (*pfnLogSigTerm)(int);
+#ifdef SIGHUP
+static void (*pfnLogSigHup)(int);
+#endif
+/**********************************************************************/
+static void vLogSignal(int iSig)
+{
+/* Writes out the buffers of the open logs, then passes the signal on
+   to the handler it displaced. The buffers are written by write(),
+   which is safe in a signal handler, where available; iLogPrintf and
+   iLogFlush keep ulLen within the data already formatted and not yet
+   written (iLogFlush clears it before writing, so that nothing is
+   written twice). The signal is taken by the main thread alone (see
+   iThreadCreate), the only one to write the logs. */
+
+struct __logsink *pls;
+void (*pfn)(int)=SIG_DFL;
+
+for(pls=plsLog; pls; pls=pls->plsNext)
+  {
+  if(!pls->ulLen)continue;
+#if !defined(__DMC__) && !defined(__BORLANDC__)
+  if(write(fileno(pls->fp), pls->pchBuf, pls->ulLen)) {}
+#else
+  fwrite(pls->pchBuf, 1, pls->ulLen, pls->fp);
+#endif
+  pls->ulLen=0;
+  }
+if(iSig==SIGINT)pfn=pfnLogSigInt;
+if(iSig==SIGTERM)pfn=pfnLogSigTerm;
+#ifdef SIGHUP
+if(iSig==SIGHUP)pfn=pfnLogSigHup;
+#endif
+signal(iSig, pfn);
+raise(iSig);
+return;
+}
+/**********************************************************************/
+static void vLogAtExit(void)
+{
+struct __logsink *pls;
+
+for(pls=plsLog; pls; pls=pls->plsNext)iLogFlush(pls);
+return;
+}
+/**********************************************************************/
+struct __logsink *pLogOpen(char *szFile, unsigned long ulFlushRecs,
+  double lfFlushSecs)
+{
+/* Opens szFile for appending, through a buffered log (see struct
+   __logsink in trn.h), or returns NULL on failure. The open logs are
+   written out by vFlush, at exit, and on the signals; the handlers are
+   installed with the first and removed with the last. Signals ignored
+   when the first log is opened remain ignored. */
+
+static int iAtExit=0;
+struct __logsink *pls;
+
+pls=(struct __logsink *)calloc(1, sizeof(struct __logsink));
+if(!pls)return(NULL);
+pls->ulMax=1UL << 16;
+pls->pchBuf=(char *)malloc(pls->ulMax);
+pls->fp=fopen(szFile, "at");
+pls->szFile=(char *)malloc(strlen(szFile) + 1);
+if(!pls->pchBuf || !pls->fp || !pls->szFile)
+  {
+  if(pls->fp)fclose(pls->fp);
+  free(pls->szFile);
+  free(pls->pchBuf);
+  free(pls);
+  return(NULL);
+  }
+setvbuf(pls->fp, NULL, _IONBF, 0);  /* pchBuf is the buffer */
+strcpy(pls->szFile, szFile);
+pls->ulFlushRecs=ulFlushRecs;
+pls->lfFlushSecs=lfFlushSecs;
+pls->lfLast=lfSeconds2();
+
+if(!plsLog)
+  {
+  if(!iAtExit)atexit(vLogAtExit);
+  iAtExit=1;
+  pfnLogSigInt=signal(SIGINT, vLogSignal);
+  if(pfnLogSigInt==SIG_IGN)signal(SIGINT, SIG_IGN);
+  pfnLogSigTerm=signal(SIGTERM, vLogSignal);
+  if(pfnLogSigTerm==SIG_IGN)signal(SIGTERM, SIG_IGN);
+#ifdef SIGHUP
+  pfnLogSigHup=signal(SIGHUP, vLogSignal);
+  if(pfnLogSigHup==SIG_IGN)signal(SIGHUP, SIG_IGN);
+#endif
+  }
+pls->plsNext=plsLog;
+plsLog=pls;
+return(pls);
+}
+/**********************************************************************/
+int iLogPrintf(struct __logsink *pls, const char *szFormat, ...)
+{
+/* As fprintf, to the buffer of the log pls. The buffer is written out
+   first if the text will not fit, and enlarged if it still will not
+   (the old buffer being freed only after the new one is in place, in
+   case of a signal). Returns the number of characters, or -1. */
+
+va_list va;
+int n;
+char *pch;
+
+va_start(va, szFormat);
+n=vsnprintf(pls->pchBuf + pls->ulLen, pls->ulMax - pls->ulLen, szFormat,
+  va);
+va_end(va);
+if(n < 0)return(-1);
+if((size_t)n < pls->ulMax - pls->ulLen)
+  {
+  pls->ulLen += n;
+  return(n);
+  }
+
+if(iLogFlush(pls))return(-1);
+if((size_t)n >= pls->ulMax)
+  {
+  pch=(char *)malloc(n + 1);
+  if(!pch)return(-1);
+  free(pls->pchBuf);
+  pls->pchBuf=pch;  /* nothing is lost, the buffer being empty */
+  pls->ulMax=n + 1;
+  }
+va_start(va, szFormat);
+n=vsnprintf(pls->pchBuf, pls->ulMax, szFormat, va);
+va_end(va);
+if((n < 0) || ((size_t)n >= pls->ulMax))return(-1);
+pls->ulLen=n;
+return(n);
+}
+/**********************************************************************/
+void vLogRecord(struct __logsink *pls)
+{
+/* Marks the end of a record, writing out the buffer if the flush
+   policy of pls calls for it. */
+
+pls->ulRecs++;
+if((pls->ulFlushRecs && (pls->ulRecs >= pls->ulFlushRecs))
+    || ((pls->lfFlushSecs > 0)
+      && (lfSeconds2() - pls->lfLast >= pls->lfFlushSecs)))
+  iLogFlush(pls);
+return;
+}
+/**********************************************************************/
+int iLogFlush(struct __logsink *pls)
+{
+/* Writes out the buffer of pls. Returns 0 if successful, -1 if not. */
+
+size_t ulLen=pls->ulLen;
+int iRet=0;
+
+pls->ulLen=0;  /* first, lest vLogSignal write the same data again */
+if(ulLen && (fwrite(pls->pchBuf, 1, ulLen, pls->fp) != ulLen))iRet=-1;
+pls->ulRecs=0;
+pls->lfLast=lfSeconds2();
+return(iRet);
+}
+/**********************************************************************/
+int iLogClose(struct __logsink *pls)
+{
+/* Writes out and closes the log pls, committing it to the disk as
+   vDurableMode directs. Returns 0 if successful, -1 if not. */
+
+struct __logsink **ppls;
+int iRet;
+
+iRet=iLogFlush(pls);
+for(ppls=&plsLog; *ppls; ppls=&(*ppls)->plsNext)
+  if(*ppls==pls)
+    {
+    *ppls=pls->plsNext;
+    break;
+    }
+if(!plsLog)
+  {
+  signal(SIGINT, pfnLogSigInt);
+  signal(SIGTERM, pfnLogSigTerm);
+#ifdef SIGHUP
+  signal(SIGHUP, pfnLogSigHup);
+#endif
+  }
+if(fclose(pls->fp))iRet=-1;
+vDurableFile(pls->szFile);
+free(pls->szFile);
+free(pls->pchBuf);
+free(pls);
+return(iRet);
+}
+/**********************************************************************/
+/*           Durability (committing files to the disk)                */
+/**********************************************************************/
+#define DURABLE_QUEUE 16
+static int iDurable=DURABLE_ASYNC;
+static char *szDurableQ[DURABLE_QUEUE];  /* files waiting, in order */
+static int nDurableQ=0, iDurableBusy=0, iDurableThread=0;
+#ifdef __PTHREADS__
+static pthread_mutex_t  mtxDurable=PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t   cvDurableWork=PTHREAD_COND_INITIALIZER;
+static pthread_cond_t   cvDurableDone=PTHREAD_COND_INITIALIZER;
+#endif
+/**********************************************************************/
+static int iSyncFile(char *szFile)
+{
+/* Commits the data of szFile to the disk, by fdatasync (or fsync where
+   that is lacking). Returns 0 if successful, or if the platform offers
+   no means, and -1 if not. */
+
+#if defined(__LINUX__) || defined(__CYGWIN__) || defined(__DJGPP__)
+
+int fd, iRet;
+
+fd=open(szFile, O_RDONLY);
+if(fd < 0)return(-1);
+#ifdef __LINUX__
+iRet=fdatasync(fd);
+#else
+iRet=fsync(fd);
+#endif
+close(fd);
+return(iRet ? -1 : 0);
+
+#else
+
+return(0);
+
+#endif
+}
+/**********************************************************************/
+#ifdef __PTHREADS__
+static void *pvDurableWorker(void *pv)
+{
+/* Commits the files queued by vDurableFile, one at a time, the lock
+   being released during each. */
+
+char *sz;
+
+pthread_mutex_lock(&mtxDurable);
+while(1)
+  {
+  while(nDurableQ==0)pthread_cond_wait(&cvDurableWork, &mtxDurable);
+  sz=szDurableQ[0];
+  nDurableQ--;
+  memmove(szDurableQ, szDurableQ + 1, nDurableQ*sizeof(char *));
+  iDurableBusy=1;
+  pthread_mutex_unlock(&mtxDurable);
+  iSyncFile(sz);
+  free(sz);
+  pthread_mutex_lock(&mtxDurable);
+  iDurableBusy=0;
+  if(nDurableQ==0)pthread_cond_broadcast(&cvDurableDone);
+  }
+return(pv);
+}
+#endif  /* __PTHREADS__ */
+/**********************************************************************/
+void vDurableWait(void)
+{
+/* Returns when the files queued by vDurableFile have been committed.
+   Registered with atexit when the queue is first used. */
+
+#ifdef __PTHREADS__
+if(!iDurableThread)return;
+pthread_mutex_lock(&mtxDurable);
+while(nDurableQ || iDurableBusy)
+  pthread_cond_wait(&cvDurableDone, &mtxDurable);
+pthread_mutex_unlock(&mtxDurable);
+#endif
+return;
+}
+/**********************************************************************/
+int iDurableMode(int iMode)
+{
+/* Sets the durability policy of vDurableFile (DURABLE_NONE,
+   DURABLE_ASYNC, or DURABLE_STRICT; see trn.h), returning the previous
+   one. Files already queued are committed first. */
+
+int iOld=iDurable;
+
+vDurableWait();
+if((iMode==DURABLE_NONE) || (iMode==DURABLE_ASYNC)
+    || (iMode==DURABLE_STRICT))iDurable=iMode;
+return(iOld);
+}
+/**********************************************************************/
+void vDurableFile(char *szFile)
+{
+/* Commits szFile (already written and flushed, or closed) to the disk
+   as iDurableMode directs: not at all, at once, or on a thread of its
+   own, so that the caller need not wait on the disk. A file already
+   waiting in the queue is not queued again. If the queue is full, or
+   the thread cannot be started, or there are no threads, the file is
+   committed at once. */
+
+#ifdef __PTHREADS__
+pthread_t th;
+char *sz;
+int i;
+#endif
+
+if((iDurable==DURABLE_NONE) || !szFile)return;
 
-  mstMemStatEx.dwLength = sizeof(mstMemStatEx);
-  hModule=LoadLibrary("kernel32.dll");
-  if(hModule)
+#ifdef __PTHREADS__
+if(iDurable==DURABLE_ASYNC)
+  {
+  pthread_mutex_lock(&mtxDurable);
+  if(!iDurableThread
+      && (iThreadCreate(&th, pvDurableWorker, NULL)==0))
     {
-    GMSX=GetProcAddress(hModule, "GlobalMemoryStatusEx");
-    if(GMSX)
+    pthread_detach(th);
+    iDurableThread=1;
+    atexit(vDurableWait);
+    }
+  if(iDurableThread)
+    {
+    for(i=0; i < nDurableQ; i++)
+      if(strcmp(szDurableQ[i], szFile)==0)break;
+    if(i < nDurableQ)
       {
-      GMSX(&mstMemStatEx);
-      return((double)mstMemStatEx.ullAvailPhys);
+      pthread_mutex_unlock(&mtxDurable);
+      return;
+      }
+    if((nDurableQ < DURABLE_QUEUE)
+        && ((sz=(char *)malloc(strlen(szFile) + 1)) != NULL))
+      {
+      strcpy(sz, szFile);
+      szDurableQ[nDurableQ++]=sz;
+      pthread_cond_signal(&cvDurableWork);
+      pthread_mutex_unlock(&mtxDurable);
+      return;
       }
     }
-
-  /* If we arrive here, the LoadLibrary and/or GetProcAddress
-     calls have failed. Default to the old GlobalMemoryStatus
-     routine. */
-
-  mstMemStat.dwLength = sizeof(mstMemStat);
-  GlobalMemoryStatus(&mstMemStat);
-  return((double)mstMemStat.dwAvailPhys);
-
-  #endif  /* Borland C 5.00+ */
-
-#else
-
-  return(-1.0);
-
+  pthread_mutex_unlock(&mtxDurable);
+  }
 #endif
-}
-/***********************************************************************/
-int iSignum(long double ldArg)
-{
-if(ldArg==0)return(0);
-return((ldArg > 0) ? +1 : -1);
+
+iSyncFile(szFile);
+return;
 }
 /**********************************************************************/
 void vFlush(void)
 {
-fflush(NULL);
+/* Writes out the open logs and the stdio buffers, and commits the logs
+   to the disk as iDurableMode directs. Other files are committed by
+   the caller, through vDurableFile; the global sync() formerly used
+   here committed every file on the system, and waited for it. */
 
-#if defined(__DJGPP__) || defined(__LINUX__) || defined(__CYGWIN__)
-sync();
-#endif
+struct __logsink *pls;
 
+for(pls=plsLog; pls; pls=pls->plsNext)iLogFlush(pls);
+fflush(NULL);
+for(pls=plsLog; pls; pls=pls->plsNext)vDurableFile(pls->szFile);
 return;
 }
 /**********************************************************************/
@@ -4716,6 +7372,34 @@ static double lftPrevious=-1e308, lft, dt;
     return(time(NULL));  /* last resort */
   #endif
     }
+#endif
+}
+/**********************************************************************/
+double lfPhaseSeconds(double *plfCPU, int iThread)
+{
+/* Returns a wall clock time in seconds, and sets *plfCPU to the
+   processor time (user and system) of the process or, if iThread is
+   nonzero, of the calling thread alone, for timing the phases of a
+   computation by differences. Unlike lfSeconds2, it keeps no state,
+   and may be called from more than one thread. Where the POSIX clocks
+   are lacking, it falls back on lfSeconds2 and clock(), which count
+   the whole process. */
+
+#if defined(__LINUX__) && defined(CLOCK_MONOTONIC)
+
+struct timespec ts;
+
+clock_gettime(iThread ? CLOCK_THREAD_CPUTIME_ID : CLOCK_PROCESS_CPUTIME_ID,
+  &ts);
+*plfCPU=ts.tv_sec + ts.tv_nsec/1e9;
+clock_gettime(CLOCK_MONOTONIC, &ts);
+return(ts.tv_sec + ts.tv_nsec/1e9);
+
+#else
+
+*plfCPU=clock()/((double)CLOCKS_PER_SEC);
+return(lfSeconds2());
+
 #endif
 }
 /**********************************************************************/
@@ -4782,12 +7466,327 @@ return(0);
 /**********************************************************************/
 #endif  /* CYGWIN or LINUX */
 /**********************************************************************/
+/*            Progress display (a status line on stderr)              */
+/**********************************************************************/
+#if defined(__LINUX__) || defined(__CYGWIN__)
+  #define __ANSI_PROGRESS__ 1  /* ANSI sequences, written directly */
+#endif
+static int iProgOn=-1;              /* -1 until the first call */
+static int iProgWidth=80, iProgShown=0;
+static double lfProgLast=-1e30;
+static double lfProgInterval=0.25;  /* seconds between updates */
+static char szProgPending[512];     /* an update held back, if any */
+static int iProgPending=0;
+#if defined(__ANSI_PROGRESS__) && defined(SIGWINCH)
+static volatile sig_atomic_t iProgResize=0;
+/**********************************************************************/
+static void vProgressResize(int iSig)
+{
+iProgResize=iSig;
+return;
+}
+#endif
+/**********************************************************************/
+static void vProgressWidth(void)
+{
+/* Finds the width of the terminal, from the terminal itself if
+   possible, otherwise from COLUMNS, otherwise 80. */
+
+char *pch;
+#if defined(__ANSI_PROGRESS__) && defined(TIOCGWINSZ)
+struct winsize ws;
+#endif
+
+iProgWidth=80;
+pch=getenv("COLUMNS");
+if(pch && (atoi(pch) > 1))iProgWidth=atoi(pch);
+#if defined(__ANSI_PROGRESS__) && defined(TIOCGWINSZ)
+if(!ioctl(fileno(stderr), TIOCGWINSZ, &ws) && (ws.ws_col > 1))
+  iProgWidth=ws.ws_col;
+#endif
+return;
+}
+/**********************************************************************/
+static int iProgressReady(void)
+{
+/* Returns 1 if the status line is to be shown, 0 if not. On the first
+   call it is decided once and for all, by whether stderr is a terminal
+   (where that can be told), and the width of the terminal is cached;
+   the width is found again only after a SIGWINCH. */
+
+if(iProgOn < 0)
+  {
+#ifdef __ANSI_PROGRESS__
+  iProgOn=isatty(fileno(stderr)) ? 1 : 0;
+  #ifdef SIGWINCH
+  if(iProgOn && (signal(SIGWINCH, vProgressResize) != SIG_DFL))
+    signal(SIGWINCH, SIG_DFL);  /* not ours to replace */
+  #endif
+#else
+  iProgOn=1;
+#endif
+  if(iProgOn)vProgressWidth();
+  }
+#if defined(__ANSI_PROGRESS__) && defined(SIGWINCH)
+if(iProgResize)
+  {
+  iProgResize=0;
+  vProgressWidth();
+  }
+#endif
+return(iProgOn);
+}
+/**********************************************************************/
+static void vProgressShow(const char *sz, int n)
+{
+/* Writes the first n characters of sz as the status line (all of sz,
+   without __ANSI_PROGRESS__). */
+
+lfProgLast=lfSeconds2();
+#ifdef __ANSI_PROGRESS__
+fprintf(stderr, "\r%.*s\033[K", n, sz);
+fflush(stderr);
+#else
+__clearline();
+cputs(sz);
+#endif
+iProgShown=1;
+iProgPending=0;
+return;
+}
+/**********************************************************************/
+void vProgress(const char *sz)
+{
+/* Shows sz on the status line of stderr, in place of what was there,
+   and only if stderr is a terminal. The text is cut at the first
+   newline, and at the width of the terminal. The first update after
+   the line has been cleared (by vProgressLine or vProgressClear) is
+   shown at once; later ones at most once every lfProgInterval seconds,
+   an update arriving sooner being held back until the next update, or
+   until vProgressFlush, so that the last status before a long test is
+   not lost. Under Linux and Cygwin the line is rewritten with ANSI
+   sequences, in one write, rather than by a call to tput or clear. */
+
+double lf;
+int n;
+
+if(!iProgressReady())return;
+n=strcspn(sz, "\r\n");
+if(n > iProgWidth - 1)n=iProgWidth - 1;
+lf=lfSeconds2();
+if(iProgShown && (lf >= lfProgLast) && (lf - lfProgLast < lfProgInterval))
+  {
+  if(n > (int)sizeof(szProgPending) - 1)n=sizeof(szProgPending) - 1;
+  memcpy(szProgPending, sz, n);
+  szProgPending[n]=0;
+  iProgPending=1;
+  return;
+  }
+vProgressShow(sz, n);
+return;
+}
+/**********************************************************************/
+void vProgressFlush(void)
+{
+/* Shows the update held back by vProgress, if any, at once; to be
+   called before a step which may take a long time. */
+
+if(iProgPending)vProgressShow(szProgPending, strlen(szProgPending));
+return;
+}
+/**********************************************************************/
+void vProgressLine(const char *sz)
+{
+/* Writes sz, a line of results (normally ending in a newline), to
+   stderr, in place of the status line if it is shown. The line is
+   written whether or not stderr is a terminal. */
+
+#ifdef __ANSI_PROGRESS__
+if(iProgressReady() && iProgShown)
+  fprintf(stderr, "\r\033[K%s", sz);
+else
+  fputs(sz, stderr);
+fflush(stderr);
+#else
+if(iProgressReady())__clearline();
+cputs(sz);
+#endif
+
+iProgShown=0;
+iProgPending=0;
+return;
+}
+/**********************************************************************/
+void vProgressClear(void)
+{
+/* Erases the status line, if it is shown. */
+
+iProgPending=0;
+if(!iProgShown)return;
+#ifdef __ANSI_PROGRESS__
+fputs("\r\033[K", stderr);
+fflush(stderr);
+#else
+__clearline();
+#endif
+iProgShown=0;
+return;
+}
+/**********************************************************************/
 void vAtExit(void)
 {
 __OBSL__;
 return;
 }
 /**********************************************************************/
+/*         Thread pool for independent tasks (POSIX threads)          */
+/**********************************************************************/
+#ifdef __PTHREADS__
+static pthread_mutex_t  mtxPool=PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t  mtxPoolJob=PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t   cvPoolWork=PTHREAD_COND_INITIALIZER;
+static pthread_cond_t   cvPoolDone=PTHREAD_COND_INITIALIZER;
+static void             (*pfnPoolTask)(void *pv, long l);
+static void             *pvPoolArg;
+static long             lPoolNext=0, lPoolTasks=0, lPoolPending=0;
+static unsigned long    ulPoolJob=0;
+static int              nPoolWorkers=0;
+#endif
+static int              nPoolThreads=1;
+/**********************************************************************/
+#ifdef __PTHREADS__
+/**********************************************************************/
+static void vPoolDrain(void)
+{
+/* Run tasks of the current job until none remain unclaimed. Called,
+   and returns, with mtxPool locked. */
+
+long l;
+void (*pfn)(void *pv, long l);
+void *pv;
+
+while(lPoolNext < lPoolTasks)
+  {
+  l=lPoolNext++;
+  pfn=pfnPoolTask;
+  pv=pvPoolArg;
+  pthread_mutex_unlock(&mtxPool);
+  pfn(pv, l);
+  pthread_mutex_lock(&mtxPool);
+  if(--lPoolPending==0)pthread_cond_signal(&cvPoolDone);
+  }
+return;
+}
+/**********************************************************************/
+static void *pvPoolWorker(void *pvArg)
+{
+unsigned long ulJob=0;
+
+pthread_mutex_lock(&mtxPool);
+while(1)
+  {
+  while(ulJob==ulPoolJob)pthread_cond_wait(&cvPoolWork, &mtxPool);
+  ulJob=ulPoolJob;
+  vPoolDrain();
+  }
+return(pvArg);  /* not reached */
+}
+/**********************************************************************/
+int iThreadCreate(pthread_t *pth, void *(*pfn)(void *pv), void *pv)
+{
+/* As pthread_create (with the default attributes), but the thread
+   starts with SIGINT, SIGTERM, and SIGHUP blocked, so that these are
+   delivered to the main thread alone, and the handler of the logs
+   (vLogSignal) never runs in a worker while the main thread is
+   writing a log. All the threads of trn.c and cglp4.c are started
+   here. */
+
+int iRet;
+#if defined(__LINUX__) || defined(__CYGWIN__)
+sigset_t ss, ssOld;
+
+sigemptyset(&ss);
+sigaddset(&ss, SIGINT);
+sigaddset(&ss, SIGTERM);
+#ifdef SIGHUP
+sigaddset(&ss, SIGHUP);
+#endif
+pthread_sigmask(SIG_BLOCK, &ss, &ssOld);  /* inherited by the thread */
+iRet=pthread_create(pth, NULL, pfn, pv);
+pthread_sigmask(SIG_SETMASK, &ssOld, NULL);
+#else
+iRet=pthread_create(pth, NULL, pfn, pv);
+#endif
+
+return(iRet);
+}
+/**********************************************************************/
+#endif  /* __PTHREADS__ */
+/**********************************************************************/
+int iPoolThreads(int nThreads)
+{
+/* Set the number of threads used by vPoolRun (including the calling
+   thread) to nThreads, if nThreads > 0; zero is ignored, and negative
+   values select the number of online processors. Returns the number
+   in effect. Without __PTHREADS__, the number is always one. Worker
+   threads are started on the first vPoolRun needing them, and are
+   never terminated. */
+
+#ifdef __PTHREADS__
+if(nThreads < 0)
+  {
+#ifdef _SC_NPROCESSORS_ONLN
+  nThreads=sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+  if(nThreads < 1)nThreads=1;
+  }
+if(nThreads > 0)nPoolThreads=nThreads;
+#endif
+return(nPoolThreads);
+}
+/**********************************************************************/
+void vPoolRun(void (*pfnTask)(void *pv, long l), void *pv, long nTasks)
+{
+/* Call pfnTask(pv, l) for l=0,1,...,nTasks-1, and return after all the
+   calls have returned. Tasks are handed out in order of l, to the pool
+   threads and to the calling thread, which also works on the job.
+
+   Only one job runs in the pool at a time. If the pool is busy, as
+   when vPoolRun is called from within a task, or concurrently from
+   another thread, the tasks are simply run in the calling thread. */
+
+long l;
+
+#ifdef __PTHREADS__
+if(nPoolThreads > 1 && nTasks > 1 && pthread_mutex_trylock(&mtxPoolJob)==0)
+  {
+  pthread_mutex_lock(&mtxPool);
+  while(nPoolWorkers < nPoolThreads - 1)
+    {
+    pthread_t th;
+    if(iThreadCreate(&th, pvPoolWorker, NULL))break;
+    pthread_detach(th);
+    nPoolWorkers++;
+    }
+  pfnPoolTask=pfnTask;
+  pvPoolArg=pv;
+  lPoolNext=0;
+  lPoolTasks=nTasks;
+  lPoolPending=nTasks;
+  ulPoolJob++;
+  pthread_cond_broadcast(&cvPoolWork);
+  vPoolDrain();
+  while(lPoolPending > 0)pthread_cond_wait(&cvPoolDone, &mtxPool);
+  pthread_mutex_unlock(&mtxPool);
+  pthread_mutex_unlock(&mtxPoolJob);
+  return;
+  }
+#endif
+
+for(l=0; l < nTasks; l++)pfnTask(pv, l);
+return;
+}
+/**********************************************************************/
 #ifdef __GMP__
 /**********************************************************************/
 /**********************************************************************/
@@ -4821,8 +7820,8 @@ GPL for additional details. */
    <http://www.trnicely.net> from a standalone to a callable procedure.
    The error jumptables were eliminated in favor of an error return
    value, and the timing and printing options were removed (except
-   after fatal errors). The procedure free_expr has been disabled
-   (it simply returns) to alleviate an untraced fatal SIGSEGV violation,
+   after fatal errors). The procedure free_expr was long disabled
+   (it simply returned) to alleviate an untraced fatal SIGSEGV violation,
    at the cost of a memory leak. This is one of many problems encountered
    with GMP's allocation, re-allocation, and memory clearing algorithms;
    either the GMP source code must be cleaned up, or workarounds must be
@@ -4830,6 +7829,8 @@ GPL for additional details. */
    preceding routines). However, iEvalExprMPZ, having been written by
    other parties, has largely been left "as is"; in general, TRN treats
    this code as a "black box"; until it breaks again, don't fix it.
+   The leak is now gone: the nodes of the trees come from an arena
+   (expr_alloc), which free_expr resets in one step.
 
    Nicely's contributions are assigned to the public domain; he
    disclaims any legal liability arising from their use. */
@@ -4937,6 +7938,7 @@ int iEvalExprMPZ(mpz_t mpzResult, char *szExpression);
 static char *skipspace _PROTO ((char *));
 static void makeexp _PROTO ((expr_t *, enum op_t, expr_t, expr_t));
 static void free_expr _PROTO ((expr_t));
+static expr_t expr_alloc _PROTO ((int));
 static char *expr _PROTO ((char *, expr_t *));
 static char *term _PROTO ((char *, expr_t *));
 static char *power _PROTO ((char *, expr_t *));
@@ -4944,6 +7946,14 @@ static char *factor _PROTO ((char *, expr_t *));
 static int match _PROTO ((char *, char *));
 static int matchp _PROTO ((char *, char *));
 static void mpz_eval_expr _PROTO ((mpz_ptr, expr_t));
+static int expr_cache_get _PROTO ((mpz_ptr, enum op_t, unsigned long int,
+                                   unsigned long int));
+static void expr_cache_put _PROTO ((mpz_ptr, enum op_t, unsigned long int,
+                                    unsigned long int));
+#if !(__GNU_MP_VERSION > 5 || (__GNU_MP_VERSION == 5 && __GNU_MP_VERSION_MINOR >= 1))
+static void mpz_prod_tree _PROTO ((mpz_ptr, unsigned long int *, unsigned long int));
+static int mpz_primorial_tree _PROTO ((mpz_ptr, unsigned long int));
+#endif
 static void mpz_eval_mod_expr _PROTO ((mpz_ptr, expr_t, mpz_ptr));
 
 char *error, *szExpressionString;
@@ -4955,9 +7965,9 @@ int iEvalExprMPZ(mpz_t mpzResult, char *szExpression)
 {
 char *str, *pchAstAst, *szCopy;
 struct expr *e;
+static int iRandInit=0;
 
 iGlobalError=0;
-gmp_randinit(rstate, GMP_RAND_ALG_LC, 128);
 szExpressionString=(char *)malloc(strlen(szExpression) + 6);
 strcpy(szExpressionString, szExpression);
 
@@ -4973,7 +7983,14 @@ strcpy(szExpressionString, szExpression);
 
 #endif
 
-gmp_randseed_ui(rstate, 1 + time(NULL)*(314159311UL + clock()));
+/* The random state is initialized and seeded only once per run. */
+
+if(!iRandInit)
+  {
+  gmp_randinit(rstate, GMP_RAND_ALG_LC, 128);
+  gmp_randseed_ui(rstate, 1 + time(NULL)*(314159311UL + clock()));
+  iRandInit=1;
+  }
 szCopy=(char *)malloc(strlen(szExpression) + 6);
 /* Remove all white space from a copy of the input. The original
    input itself will not be modified, only the copy, whose value
@@ -5298,10 +8315,9 @@ static char *factor (char *str, expr_t *e)
     {
       expr_t res;
       char *s, *sc;
+      size_t n;
 
-      res = (expr_t) malloc (sizeof (struct expr));
-      res -> op = LIT;
-      mpz_init (res->operands.val);
+      res = expr_alloc (1);
 
       s = str;
       while (isalnum (str[0]) || str[0]=='.')
@@ -5309,17 +8325,40 @@ static char *factor (char *str, expr_t *e)
       sc = (char *) malloc (str - s + 1);
       memcpy (sc, s, str - s);
       sc[str - s] = 0;
+      /* Plain decimal integers, by far the most common tokens, are
+	 converted directly (through a machine word if small); see
+	 below for the others.  */
+      n = strspn (sc, "0123456789");
+      if (sc[n] == 0 && n < 10 && (sc[0] != '0' || n == 1))
+	mpz_set_ui (res->operands.val, strtoul (sc, NULL, 10));
 #ifdef __MPFR__  /* To parse tokens such as 1.32e9 */
+      else if (sc[n] == 0)
+	mpz_set_str (res->operands.val, sc, 10);
+      else
       {
+      /* The precision is that of the integer part of the value, i.e.,
+	 the digits of the token plus a positive decimal exponent, with
+	 a guard limb, but at most 332200 bits (100,002 digits). */
       mpfr_t mpfr;
-      mpfr_set_default_prec(332200);  /* 100,002 decimal digits */
-      mpfr_init(mpfr);
+      char *pchE;
+      double lfDigits;
+      int iPrec;
+
+      pchE = strpbrk (sc, "eE");
+      lfDigits = pchE ? pchE - sc : strlen (sc);
+      if (pchE && strtol (pchE + 1, NULL, 10) > 0)
+	lfDigits += strtol (pchE + 1, NULL, 10);
+      if (lfDigits > 100002)
+	lfDigits = 100002;
+      iPrec = ceil (lfDigits*3.321928094887362) + 64;
+      mpfr_init2(mpfr, iPrec);
       mpfr_set_str(mpfr, sc, 10, GMP_RNDN);
       mpfr_get_z(res->operands.val, mpfr, GMP_RNDN);
       mpfr_clear(mpfr);
       }
 #else
-      __mpz_set_str (res->operands.val, sc, 0);
+      else
+	__mpz_set_str (res->operands.val, sc, 0);
 #endif
       *e = res;
       free (sc);
@@ -5345,7 +8384,7 @@ static void makeexp(expr_t *r, enum op_t op, expr_t lhs, expr_t rhs)
    RHS and left hand side lhs.  Put the result in R.  */
 
   expr_t res;
-  res = (expr_t) malloc (sizeof (struct expr));
+  res = expr_alloc (0);
   res -> op = op;
   res -> operands.ops.lhs = lhs;
   res -> operands.ops.rhs = rhs;
@@ -5353,32 +8392,221 @@ static void makeexp(expr_t *r, enum op_t op, expr_t lhs, expr_t rhs)
   return;
 }
 /**********************************************************************/
+/* Arena for the nodes of expression trees. Nodes are handed out in
+   order from chained blocks of EXPR_ARENA_BLOCK, which are kept for
+   reuse by later evaluations rather than freed, so that free_expr is
+   a constant time reset and parsing does no malloc once the blocks
+   needed by the largest expression exist. Literal (LIT) nodes have a
+   pool of their own, whose mpz_t values are initialized once and then
+   reused for the literals of later expressions. No node is ever
+   passed to free, so an incomplete tree (left by a syntax error) is
+   harmless; freeing such trees node by node was the likely cause of
+   the crashes which led to free_expr being disabled in 2003. */
+
+#define EXPR_ARENA_BLOCK 64
+
+struct expr_arena
+{
+  struct expr node[EXPR_ARENA_BLOCK];
+  struct expr_arena *next;
+};
+
+struct expr_pool
+{
+  struct expr_arena *first, *cur;   /* cur is NULL after a reset */
+  int used;                         /* nodes used in cur */
+};
+static struct expr_pool expr_pools[2];  /* [0] operators, [1] literals */
+/**********************************************************************/
+static expr_t expr_alloc(int lit)
+{
+/* Return a node from the operator pool, or (if LIT is nonzero) a LIT
+   node from the literal pool, with its value initialized.  */
+
+  struct expr_pool *pool = &expr_pools[lit != 0];
+  struct expr_arena *next;
+  int i;
+
+  if (pool->cur == NULL || pool->used == EXPR_ARENA_BLOCK)
+    {
+      next = pool->cur ? pool->cur->next : pool->first;
+      if (next == NULL)
+	{
+	  next = (struct expr_arena *) malloc (sizeof (struct expr_arena));
+	  if (next == NULL)
+	    {
+	      fprintf (stderr, "\n ERROR: Out of memory in expr_alloc.\n");
+	      exit (EXIT_FAILURE);
+	    }
+	  next->next = NULL;
+	  if (lit)
+	    for (i = 0; i < EXPR_ARENA_BLOCK; i++)
+	      {
+		next->node[i].op = LIT;
+		mpz_init (next->node[i].operands.val);
+	      }
+	  if (pool->cur)
+	    pool->cur->next = next;
+	  else
+	    pool->first = next;
+	}
+      pool->cur = next;
+      pool->used = 0;
+    }
+  return &pool->cur->node[pool->used++];
+}
+/**********************************************************************/
 static void free_expr(expr_t e)
 {
-/* Free the memory used by expression E.  */
+/* Release the expression E, and with it all the nodes allocated since
+   the last call, by resetting the arena (only one tree is ever live).
+   E itself need not be complete or even valid.  */
 
+  expr_pools[0].cur = expr_pools[1].cur = NULL;
+  expr_pools[0].used = expr_pools[1].used = 0;
   return;
+}
+/**********************************************************************/
+/* Cache of the values of the costly subexpressions p#, n!, fib(n), and
+   x^y (x and y single-limb), which gap lists repeat heavily (e.g.,
+   k*(1237#)/30 - m), so that they are computed once per run rather than
+   once per record. An entry is keyed by the operator and its operand
+   values, and small values (cheaper to recompute than to look up) are
+   not cached. The cache is bounded by EXPR_CACHE_SLOTS entries and
+   EXPR_CACHE_LIMBS limbs in all, the least recently used entries being
+   discarded to make room. */
+
+#define EXPR_CACHE_SLOTS 64
+#define EXPR_CACHE_LIMBS (1UL << 20)
+#define EXPR_CACHE_MIN_LIMBS 8
+
+struct expr_cache_ent
+{
+  enum op_t op;                 /* NOP for an empty slot */
+  unsigned long int a, b;       /* operand values */
+  unsigned long int use;        /* time of last use, for LRU eviction */
+  mpz_t val;
+};
+static struct expr_cache_ent expr_cache[EXPR_CACHE_SLOTS];
+static unsigned long int expr_cache_clock, expr_cache_limbs;
+/**********************************************************************/
+static int expr_cache_get(mpz_ptr r, enum op_t op, unsigned long int a,
+  unsigned long int b)
+{
+/* If the value of OP(A, B) is cached, set R to it and return 1;
+   otherwise return 0. The table is small enough to search linearly. */
+
+  int i;
+
+  for (i = 0; i < EXPR_CACHE_SLOTS; i++)
+    if (expr_cache[i].op == op && expr_cache[i].a == a
+        && expr_cache[i].b == b)
+      {
+	expr_cache[i].use = ++expr_cache_clock;
+	mpz_set (r, expr_cache[i].val);
+	return 1;
+      }
+  return 0;
+}
+/**********************************************************************/
+static void expr_cache_put(mpz_ptr v, enum op_t op, unsigned long int a,
+  unsigned long int b)
+{
+/* Record V as the value of OP(A, B), evicting least recently used
+   entries as needed to stay within the bounds of the cache.  */
 
-/* Bug-fixing hack (T. R. Nicely 2003.10.10).  This routine was
-   generating unpredictable crashes (non-trappable SIGSEGV violations).
-   Signal trapping and other measures failed to solve the problem,
-   and the ultimate fault has not been fixed or even pinned down.
-   Disabling the routine leaves a potential memory leak in the
-   program, which has thus far not been a problem. */
+  int i, j;
+  unsigned long int n = mpz_size (v);
 
-  if (e->op != LIT)
+  if (n < EXPR_CACHE_MIN_LIMBS || n > EXPR_CACHE_LIMBS/4)
+    return;
+  for (;;)
     {
-      free_expr (e->operands.ops.lhs);
-      if (e->operands.ops.rhs != NULL)
-	free_expr (e->operands.ops.rhs);
+      for (i = 0, j = -1; i < EXPR_CACHE_SLOTS; i++)
+	{
+	  if (expr_cache[i].op == NOP)
+	    break;
+	  if (j < 0 || expr_cache[i].use < expr_cache[j].use)
+	    j = i;
+	}
+      if (i < EXPR_CACHE_SLOTS && expr_cache_limbs + n <= EXPR_CACHE_LIMBS)
+	break;
+      expr_cache_limbs -= mpz_size (expr_cache[j].val);
+      mpz_clear (expr_cache[j].val);
+      expr_cache[j].op = NOP;
     }
-  else
+  mpz_init_set (expr_cache[i].val, v);
+  expr_cache[i].op = op;
+  expr_cache[i].a = a;
+  expr_cache[i].b = b;
+  expr_cache[i].use = ++expr_cache_clock;
+  expr_cache_limbs += n;
+  return;
+}
+/**********************************************************************/
+#if !(__GNU_MP_VERSION > 5 || (__GNU_MP_VERSION == 5 && __GNU_MP_VERSION_MINOR >= 1))
+static void mpz_prod_tree(mpz_ptr r, unsigned long int *a, unsigned long int n)
+{
+/* Set R to the product of the N > 0 integers A[0..N-1], multiplying
+   balanced halves, so that the large multiplications are of operands
+   of equal size (subquadratic in GMP), rather than growing the product
+   one factor at a time.  */
+
+  unsigned long int i;
+  mpz_t t;
+
+  if (n <= 16)
     {
-      mpz_clear (e->operands.val);
+      mpz_set_ui (r, a[0]);
+      for (i = 1; i < n; i++)
+	mpz_mul_ui (r, r, a[i]);
+      return;
     }
+  mpz_init (t);
+  mpz_prod_tree (r, a, n/2);
+  mpz_prod_tree (t, a + n/2, n - n/2);
+  mpz_mul (r, r, t);
+  mpz_clear (t);
   return;
 }
 /**********************************************************************/
+static int mpz_primorial_tree(mpz_ptr r, unsigned long int n)
+{
+/* Set R to n#, the product of the primes <= N, for GMP releases before
+   5.1 (which lack mpz_primorial_ui). The primes are listed by a sieve
+   of Eratosthenes on the odd integers and multiplied by mpz_prod_tree.
+   Returns 0, or -1 if the memory needed is unavailable.  */
+
+  unsigned long int i, j, np, *a;
+  char *c;
+
+  mpz_set_ui (r, 1);
+  if (n < 2)
+    return 0;
+  c = (char *) calloc (n/2 + 1, 1);  /* c[i] <==> 2i + 1 composite */
+  a = (unsigned long int *) malloc ((n/2 + 2) * sizeof (unsigned long int));
+  if (c == NULL || a == NULL)
+    {
+      free (c);
+      free (a);
+      return -1;
+    }
+  for (i = 1; (2*i + 1) <= n/(2*i + 1); i++)
+    if (!c[i])
+      for (j = 2*i*(i + 1); j <= (n - 1)/2; j += 2*i + 1)
+	c[j] = 1;
+  a[0] = 2;
+  np = 1;
+  for (i = 1; i <= (n - 1)/2; i++)
+    if (!c[i])
+      a[np++] = 2*i + 1;
+  mpz_prod_tree (r, a, np);
+  free (c);
+  free (a);
+  return 0;
+}
+#endif
+/**********************************************************************/
 static void mpz_eval_expr(mpz_ptr r, expr_t e)
 {
 /* Evaluate the expression E and put the result in R.  */
@@ -5489,12 +8717,18 @@ static void mpz_eval_expr(mpz_ptr r, expr_t e)
       else
 	{
 	  unsigned long int cnt;
-	  unsigned long int y;
+	  unsigned long int x, y;
 	  /* error if exponent does not fit into an unsigned long int.  */
 	  if (mpz_cmp_ui (rhs, ~(unsigned long int) 0) > 0)
 	    goto pow_err;
 
 	  y = mpz_get_ui (rhs);
+	  x = mpz_fits_ulong_p (lhs) ? mpz_get_ui (lhs) : 0;  /* cache key */
+	  if (x && expr_cache_get (r, POW, x, y))
+	    {
+	      mpz_clear (lhs); mpz_clear (rhs);
+	      return;
+	    }
 	  /* x^y == (x/(2^c))^y * 2^(c*y) */
 #if __GNU_MP_VERSION >= 2
 	  cnt = mpz_scan1 (lhs, 0);
@@ -5511,6 +8745,8 @@ static void mpz_eval_expr(mpz_ptr r, expr_t e)
 	    }
 	  else
 	    mpz_pow_ui (r, lhs, y);
+	  if (x)
+	    expr_cache_put (r, POW, x, y);
 	}
       mpz_clear (lhs); mpz_clear (rhs);
       return;
@@ -5625,7 +8861,13 @@ static void mpz_eval_expr(mpz_ptr r, expr_t e)
           mpz_set_ui(r,1);
           return;
 	}
-      mpz_fac_ui (r, mpz_get_ui (r));
+      { unsigned long int n = mpz_get_ui (r);
+	if (!expr_cache_get (r, FAC, n, 0))
+	  {
+	    mpz_fac_ui (r, n);
+	    expr_cache_put (r, FAC, n, 0);
+	  }
+      }
       return;
     case PRIMORIAL:
       mpz_eval_expr (r, e->operands.ops.lhs);
@@ -5636,21 +8878,21 @@ static void mpz_eval_expr(mpz_ptr r, expr_t e)
           mpz_set_ui(r,1);
           return;
 	}
-      { unsigned long ulArg;
-        ulArg=mpz_get_ui(r);
-        if(ulArg < 2){mpz_set_ui(r,1);return;}
-        mpz_set_ui(r,2);
-        if(ulArg < 3)return;
-        mpz_init(lhs); mpz_init(rhs);
-        mpz_set_ui(rhs, 2);
-        while(1)
-          {
-          mpz_nextprime(lhs,rhs); /* rhs=prev_prime, lhs=next_prime */
-          if(mpz_cmp_ui(lhs,ulArg) > 0)break;
-          mpz_mul(r,lhs,r);
-          mpz_set(rhs,lhs);
-          }
-        mpz_clear(lhs);mpz_clear(rhs);
+      { unsigned long int n = mpz_get_ui (r);
+	if (expr_cache_get (r, PRIMORIAL, n, 0))
+	  return;
+#if __GNU_MP_VERSION > 5 || (__GNU_MP_VERSION == 5 && __GNU_MP_VERSION_MINOR >= 1)
+	mpz_primorial_ui (r, n);
+#else
+	if (mpz_primorial_tree (r, n) != 0)
+	  {
+	    error = "result of `#' operator too large";
+	    iGlobalError=-1;
+            mpz_set_ui(r,1);
+            return;
+	  }
+#endif
+	expr_cache_put (r, PRIMORIAL, n, 0);
       }
       return;
 #if __GNU_MP_VERSION >= 2
@@ -5763,25 +9005,38 @@ static void mpz_eval_expr(mpz_ptr r, expr_t e)
 	  }
 	n = mpz_get_ui (lhs);
 	mpz_clear (lhs);
+	if (expr_cache_get (r, FIBONACCI, n, 0))
+	  return;
 
 #if __GNU_MP_VERSION > 2 || __GNU_MP_VERSION_MINOR >= 1
 	mpz_fib_ui (r, n);
 #else
+	/* Fast doubling, from the most significant bit of N down:
+	   with R = F(k) and T = F(k+1), F(2k) = F(k)(2F(k+1) - F(k))
+	   and F(2k+1) = F(k)^2 + F(k+1)^2.  */
 	mpz_init_set_ui (t, 1);
-	mpz_set_ui (r, 1);
-
-	if (n <= 2)
-	  mpz_set_ui (r, 1);
-	else
+	mpz_init (lhs);
+	mpz_set_ui (r, 0);
+	for (i = 8*sizeof (n); i-- > 0; )
 	  {
-	    for (i = 3; i <= n; i++)
+	    mpz_mul_2exp (lhs, t, 1);
+	    mpz_sub (lhs, lhs, r);
+	    mpz_mul (lhs, lhs, r);
+	    mpz_mul (r, r, r);
+	    mpz_mul (t, t, t);
+	    mpz_add (t, t, r);
+	    mpz_swap (r, lhs);
+	    if ((n >> i) & 1)
 	      {
-		mpz_add (t, t, r);
-		mpz_swap (t, r);
+		mpz_add (lhs, r, t);
+		mpz_swap (r, t);
+		mpz_swap (t, lhs);
 	      }
 	  }
+	mpz_clear (lhs);
 	mpz_clear (t);
 #endif
+	expr_cache_put (r, FIBONACCI, n, 0);
       }
       return;
     case RANDOM:
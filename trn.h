@@ -65,6 +65,7 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <stdarg.h>
 #include <string.h>
 #include <signal.h>
 #include <time.h>
@@ -153,6 +154,9 @@
 #if !defined(__DMC__) && !defined(__BORLANDC__)
   #include <unistd.h>
 #endif
+#if defined(__LINUX__) || defined(__CYGWIN__) || defined(__DJGPP__)
+  #include <fcntl.h>
+#endif
 #ifdef __DJGPP__
   #include <io.h>
   #include <conio.h>
@@ -375,6 +379,60 @@
   #warning WARNING: MPFR version should be 2.4.1 or later.
 #endif
 
+/************************** POSIX threads support *********************/
+
+/* The macro __PTHREADS__ indicates support for POSIX threads, used by
+   the thread pool (vPoolRun) which runs the independent rounds of
+   iPrP concurrently. It is assumed to be present on GNU/Linux, Cygwin,
+   and MinGW (winpthreads). To compile without threads on these
+   platforms, add the command-line parameter "-D__NOPTHREADS__" (or
+   the equivalent); the pool routines then run all tasks in the
+   calling thread. Link with -lpthread where required. */
+
+#undef __PTHREADS__
+#ifndef __NOPTHREADS__
+  #if defined(__LINUX__) || defined(__CYGWIN__) || defined(__MINGW__)
+    #define __PTHREADS__ 1
+    #include <pthread.h>
+  #endif
+#endif  /* not NOPTHREADS */
+
+/************************ Memory-mapped input *************************/
+
+/* The macro __MMAP__ indicates support for mmap, used by pGapListOpen
+   to read gap lists in place rather than through stdio. It is assumed
+   to be present on GNU/Linux and Cygwin; to compile without it, add
+   "-D__NOMMAP__". Elsewhere, or if a file cannot be mapped, the gap
+   list is read with fgets. */
+
+#undef __MMAP__
+#ifndef __NOMMAP__
+  #if defined(__LINUX__) || defined(__CYGWIN__)
+    #define __MMAP__ 1
+    #include <sys/mman.h>
+    #include <fcntl.h>
+    #include <unistd.h>
+  #endif
+#endif  /* not NOMMAP */
+
+/************************* Coprocess provers **************************/
+
+/* The macro __COPROC__ indicates support for fork, pipes, and
+   waitpid, used by the provers of kind PROVER_COPROC (see
+   lProverTest). It is assumed to be present on GNU/Linux and Cygwin;
+   to compile without it, add "-D__NOCOPROC__". */
+
+#undef __COPROC__
+#ifndef __NOCOPROC__
+  #if defined(__LINUX__) || defined(__CYGWIN__)
+    #define __COPROC__ 1
+    #include <sys/types.h>
+    #include <sys/wait.h>
+    #include <fcntl.h>
+    #include <unistd.h>
+  #endif
+#endif  /* not NOCOPROC */
+
 /**********************************************************************/
 /******************** MANIFEST CONSTANTS CORRECTED ********************/
 /**********************************************************************/
@@ -652,6 +710,7 @@ long double         __mpz_get_ld(mpz_t mpz);
 void                __mpz_set_ld(mpz_t mpz, long double ld);
 int                 __mpz_cmp_ld(mpz_t mpz, long double ld);
 long double         __mpz_log10l(mpz_t mpz);
+unsigned long       __mpz_ndigits10(mpz_t mpz);
 long double         __mpz_logl(mpz_t mpz);
 void                __mpz_powl(mpz_t mpz, long double ldBase,
                       long double ldExp);
@@ -661,17 +720,108 @@ long double         __mpf_get_ld(mpf_t mpf);
 void                __mpf_set_ld(mpf_t mpf, long double ld);
 void                __mpf_set_ld2(mpf_t mpf, long double ld);
 
+/* Modulus context for repeated reductions modulo the same N. It is
+   created once per candidate N and shared by the Miller squaring
+   chains and the Lucas ladders of all the tests applied to N. If
+   N = 2^n + c with small |c|, reductions use shifts and a single-limb
+   multiply; otherwise, for large N a Barrett reciprocal is
+   precomputed, and for smaller N, where GMP's own division is faster,
+   mpz_mod is used. The small prime screening of Miller's test is also
+   carried out only once per context. */
+
+struct __mpz_modctx
+  {
+  mpz_t mpzN;              /* the modulus N (odd, N > 2) */
+  mpz_t mpzMu;             /* floor(4^k/N), k=ulBits (Barrett only;
+                              0 until the first Barrett reduction) */
+  mpz_t mpzQ;              /* scratch for the quotient estimate */
+  mpz_t mpzNm1;            /* N - 1 */
+  mpz_t mpzd;              /* odd d with N - 1 = (2^s)*d */
+  unsigned long ulBits;    /* k, the number of binary digits in N */
+  unsigned long ulS;       /* s, as above */
+  int iBarrett;            /* nonzero if Barrett reduction is used */
+  int iSpecial;            /* nonzero if N = 2^ulExp2 + lC, as below */
+  unsigned long ulExp2;    /* n, for special N */
+  long lC;                 /* c, for special N (|c| <= LONG_MAX) */
+  int iScreen;             /* small prime screening: -1 not yet done,
+                              0 composite, 1 prime, 2 inconclusive */
+  int *piAbort;            /* if non-NULL and set, abandon the test
+                              (accessed atomically; see iAbortGet) */
+  };
+
+void    __mpz_modctx_init(struct __mpz_modctx *pmc, mpz_t mpzN);
+void    __mpz_modctx_clear(struct __mpz_modctx *pmc);
+void    __mpz_mod_ctx(mpz_t mpzR, mpz_t mpzX, struct __mpz_modctx *pmc);
+void    __mpz_powm_ctx(mpz_t mpzR, mpz_t mpzB, mpz_t mpzE,
+	  struct __mpz_modctx *pmc);
+
 /* Prime number generation and testing using GMP */
 
 int     iPrP(mpz_t mpzN, unsigned long ulNMR, unsigned long ulMaxDivisor);
-int     iIsPrime64(uint64_t ullN, unsigned long ulMaxDivisor);
+
+/* Options for iPrPBatch, which tests a vector of candidates at once. */
+
+struct __prpbatch_opts
+  {
+  unsigned long ulNMR;         /* number of Miller's tests, as in iPrP */
+  unsigned long ulMaxDivisor;  /* trial divisor bound, as in iPrP */
+  int iMR2;                    /* Miller's test with B=2 only */
+  int iFermat;                 /* base-2 Fermat test first */
+  int iStopAtPrime;            /* stop at the first prime, index order */
+  };
+
+int     iPrPBatch(mpz_t *pmpzN, size_t n, int *piResult,
+	  struct __prpbatch_opts *pOpts);
+
+/* Provers: the backends which test a batch of candidates, base +
+   offset, for probable primality (see lProverTest). PROVER_GMP tests
+   them here, with iPrPBatch; PROVER_MOCK also tests them here, but
+   with mpz_probab_prime_p, as a stand-in for an external prover in
+   tests; PROVER_BATCH runs a command once for each batch, on an ABC
+   file (as PFGW reads it); and PROVER_COPROC keeps a command running,
+   speaking a line protocol to it through pipes (__COPROC__ only). */
+
+#define PROVER_GMP    0
+#define PROVER_MOCK   1
+#define PROVER_BATCH  2
+#define PROVER_COPROC 3
+
+struct __prover
+  {
+  int iKind;                 /* PROVER_GMP, ..., PROVER_COPROC */
+  int iFailed;               /* an external prover has failed */
+  char *szSpec;              /* as given to pProverNew */
+  char *szCmd;               /* the command, within szSpec */
+  char szIn[64], szOut[64];  /* files of PROVER_BATCH */
+  mpz_t *pmpz;               /* candidates of PROVER_GMP, PROVER_MOCK */
+  long nMpz;
+  mpz_t mpzBase;             /* the base last sent to PROVER_COPROC */
+  int iBase;                 /* mpzBase has been sent */
+  FILE *fpTo, *fpFrom;       /* the pipes of PROVER_COPROC */
+#ifdef __COPROC__
+  pid_t iPid;                /* its process, or -1 */
+#endif
+  };
+
+struct __prover *pProverNew(const char *szSpec);
+long    lProverTest(struct __prover *ppr, mpz_t mpzBase,
+	  unsigned long *pulOff, long n, int *piResult,
+	  struct __prpbatch_opts *pOpts);
+void    vProverClose(struct __prover *ppr);
+
 unsigned long ulPrmDiv(mpz_t mpzN, unsigned long ulMaxDivisor);
+unsigned long ulPMinus1B1(unsigned long ulBits, double lfTD);
+void    vPMinus1Exp(mpz_t mpzE, unsigned long ulB1);
+int     iPMinus1(mpz_t mpzF, mpz_t mpzN, mpz_t mpzE);
 int     iMillerRabin(mpz_t N, const long iB);
 int     iMiller(mpz_t mpzN, long iB);
+int     iMillerCtx(mpz_t mpzN, long iB, struct __mpz_modctx *pmc);
 int     iBPSW(mpz_t mpzN);
 int     iLucasSelfridge(mpz_t mpzN);
 int     iStrongLucasSelfridge(mpz_t mpzN);
+int     iStrongLucasSelfridgeCtx(mpz_t mpzN, struct __mpz_modctx *pmc);
 int     iExtraStrongLucas(mpz_t mpzN, long lB);
+int     iExtraStrongLucasCtx(mpz_t mpzN, long lB, struct __mpz_modctx *pmc);
 
 /* Expression parser for mpz bigints. iEvalExpr and iParseMPZ are
    deprecated identifiers. Uses GMP. */
@@ -690,6 +840,140 @@ int     iEvalExprMPZ(mpz_t mpzResult, char *szExpression);
 
 int         iRecordValidExt(char *sz);
 int         iGetGapRecExt(char *szGapRec, FILE *fpIn);
+
+/* A gap list file opened for reading by pGapListOpen. Its lines are
+   found in place, within a read-only mapping of the file, or read into
+   szLine if it is not mapped; records are returned by iGetGapRecView
+   within szLine in either case. The list may also be a binary gap list
+   (see below). */
+
+struct __gaplist
+  {
+  char *pchMap;      /* the mapping, or NULL if the file is read by fp */
+  size_t ulSize;     /* size of the mapping */
+  size_t ulPos;      /* offset of the next line in the mapping */
+  FILE *fp;          /* the file, if it is not mapped */
+  char *szLine;      /* buffer of __MAX_DIGITS__ bytes for the record */
+  int iBinary;       /* 1 for a binary gap list */
+  uint64_t nRec;     /* binary: number of records */
+  uint64_t ulIdxOff; /* binary: offset of the index (end of records) */
+  char *szFile;      /* name of the file */
+  size_t *pulSel;    /* offsets of the selected records, in file order,
+                        or NULL (see lGapListSelect) */
+  size_t nSel;       /* number of selected records */
+  size_t iSel;       /* next selected record */
+  };
+
+/* A binary gap list holds the records of a gap list together with
+   their values of P1, already evaluated, so that they are read without
+   being parsed again. It consists of a header; the records, each a
+   struct __gapbinrec followed by the text of the record (ulLen bytes
+   and a NUL) and P1 as written by mpz_out_raw; and an index of the
+   records, 8-byte aligned, as nRec entries sorted by gap followed by
+   nRec entries sorted by digits. The fields are in the byte order of
+   the machine which wrote the list (ulOrder), and such a list is not
+   read on a machine of the other byte order. */
+
+#define __GAPBIN_MAGIC__   "CGLP4GPB"
+#define __GAPBIN_ORDER__   0x01020304UL
+#define __GAPBIN_VERSION__ 1
+
+struct __gapbinhdr
+  {
+  char szMagic[8];      /* __GAPBIN_MAGIC__, not NUL terminated */
+  uint32_t ulOrder;     /* __GAPBIN_ORDER__ */
+  uint32_t ulVersion;   /* __GAPBIN_VERSION__ */
+  uint64_t nRec;        /* number of records */
+  uint64_t ulIdxOff;    /* offset of the index */
+  };
+
+struct __gapbinrec
+  {
+  uint32_t ulGap;       /* gap measure */
+  uint32_t ulD1;        /* digits in P1 */
+  uint32_t iType;       /* 6, 9, or 1, as returned by iRecordValidExt */
+  uint32_t ulP1Off;     /* offset of P1 within the text */
+  uint32_t ulLen;       /* length of the text */
+  };
+
+struct __gapbinidx
+  {
+  uint32_t ulGap;
+  uint32_t ulD1;
+  uint64_t ulOff;       /* offset of the record */
+  };
+
+/* The sidecar index of a text gap list szFile is the file szFile.gix,
+   written by lGapListSelect: a struct __gapidxhdr, followed by the
+   index of the valid records of the list, as in a binary gap list
+   (the offsets being those of the first lines of the records). It is
+   rebuilt whenever the size, modification time (to the nanosecond,
+   where the system records it), or inode number of the list no longer
+   match those recorded. It is written to a temporary file, renamed
+   into place once complete. */
+
+#define __GAPIDX_MAGIC__   "CGLP4GIX"
+#define __GAPIDX_VERSION__ 2
+
+struct __gapidxhdr
+  {
+  char szMagic[8];      /* __GAPIDX_MAGIC__, not NUL terminated */
+  uint32_t ulOrder;     /* __GAPBIN_ORDER__ */
+  uint32_t ulVersion;   /* __GAPIDX_VERSION__ */
+  uint64_t nRec;        /* number of records indexed */
+  uint64_t ulListSize;  /* size of the list when indexed */
+  int64_t lListTime;    /* modification time of the list when indexed */
+  int64_t lListNsec;    /* nanoseconds of that time, or 0 */
+  uint64_t ulListIno;   /* inode number of the list, or 0 */
+  };
+
+struct __gaplist *pGapListOpen(char *szFile);
+void        vGapListClose(struct __gaplist *pgl);
+long        lGapListSelect(struct __gaplist *pgl, unsigned long ulMinGap,
+	      unsigned long ulMaxGap, unsigned long ulMinDigits,
+	      unsigned long ulMaxDigits);
+int         iGetGapRecView(struct __gaplist *pgl, char **ppchRec);
+
+#ifdef __GMP__
+
+/* A gap record read by iGetGapRecObj, parsed once; P1 is evaluated at
+   most once (see iGapRecP1). */
+
+struct __gaprec
+  {
+  int iType;            /* 6, 9, or 1, as returned by iRecordValidExt */
+  unsigned long ulGap;  /* gap measure */
+  unsigned long ulD1;   /* digits in P1: stated (6, 9) or counted (1) */
+  char *szRec;          /* the record (see iGetGapRecView) */
+  char *szP1;           /* P1 as written, within szRec */
+  int iP1;              /* 1 if mpzP1 holds P1, -1 if P1 is invalid,
+                           0 if it has not yet been evaluated */
+  mpz_t mpzP1;
+  };
+
+void        vGapRecInit(struct __gaprec *pgr);
+void        vGapRecClear(struct __gaprec *pgr);
+int         iGetGapRecObj(struct __gaplist *pgl, struct __gaprec *pgr);
+int         iGapRecP1(struct __gaprec *pgr);
+
+/* A binary gap list being written (see struct __gapbinhdr). */
+
+struct __gapbinout
+  {
+  FILE *fp;
+  uint64_t ulPos;              /* offset of the next record */
+  size_t nRec, nMax;           /* records written, and room in pIdx */
+  struct __gapbinidx *pIdx;    /* index entries, in file order */
+  };
+
+struct __gapbinout *pGapBinCreate(char *szFile);
+int         iGapBinWrite(struct __gapbinout *pgbo, char *szRec,
+	      char *szP1, int iType, unsigned long ulGap,
+	      unsigned long ulD1, mpz_t mpzP1);
+int         iGapBinClose(struct __gapbinout *pgbo);
+
+#endif /* __GMP__ */
+
 void        vGapContExt(char *szContRec, char *szGapRec);
 int         iGetGapRec(char *szGapRec, FILE *fpIn);
 int         iRecordValid(char *szRec);
@@ -711,6 +995,8 @@ void     vSieveForDivisors(unsigned char *uchPrime, unsigned long ulStart,
 void     vSieveULL(unsigned char *uchPrime, uint64_t ullStart,
 	   uint64_t ullEnd);
 int      iIsPrime32(unsigned long ulN);
+int      iIsPrime64(uint64_t ullN, unsigned long ulMaxDivisor);
+int      iBPSW64(uint64_t ullN);
 int64_t  sllLML(uint64_t ullx);  /* pi(x) using LML algorithm; see lml.c */
 
 /* Functions returning (for x >= 2) Li(x); the Hardy-Littlewood integral
@@ -781,8 +1067,70 @@ long           __lRFile(char *szFileName);
 long           __lRWFile(char *szFileName);
 void           __vREF(char *szFileName);
 double         lfSeconds2(void);
+double         lfPhaseSeconds(double *plfCPU, int iThread);
 unsigned long  ulSqrt(uint64_t ull);
 void           vAtExit(void);
+void           vProgress(const char *sz);
+void           vProgressFlush(void);
+void           vProgressLine(const char *sz);
+void           vProgressClear(void);
+
+/* Buffered log, for a results file appended to by one thread (see
+   pLogOpen). iLogPrintf formats into the buffer, and vLogRecord marks
+   the end of a record, after which the buffer is written out if
+   ulFlushRecs records or lfFlushSecs seconds have passed since it was
+   last written (zero disables either). It is also written out when
+   full, by iLogFlush, iLogClose, and vFlush, at exit, and on SIGINT,
+   SIGTERM, or SIGHUP. Several logs may be open at once. */
+
+struct __logsink
+  {
+  FILE *fp;                   /* the file, unbuffered */
+  char *szFile;               /* its name, for vDurableFile */
+  char *pchBuf;               /* the buffer, of ulMax bytes */
+  size_t ulLen, ulMax;        /* bytes in the buffer, and its size */
+  unsigned long ulRecs;       /* records since the last write */
+  unsigned long ulFlushRecs;
+  double lfFlushSecs, lfLast; /* lfLast: time of the last write */
+  struct __logsink *plsNext;  /* the next open log */
+  };
+
+struct __logsink *pLogOpen(char *szFile, unsigned long ulFlushRecs,
+		   double lfFlushSecs);
+int            iLogPrintf(struct __logsink *pls, const char *szFormat,
+		 ...);
+void           vLogRecord(struct __logsink *pls);
+int            iLogFlush(struct __logsink *pls);
+int            iLogClose(struct __logsink *pls);
+
+/* Durability. vDurableFile commits a file which has been written to the
+   disk (fdatasync), as set by iDurableMode: DURABLE_NONE leaves it to
+   the operating system, DURABLE_STRICT waits for the disk, and
+   DURABLE_ASYNC (the default) queues the file for a thread of its own,
+   which is waited for at exit. Without __PTHREADS__, DURABLE_ASYNC is
+   DURABLE_STRICT. */
+
+#define DURABLE_NONE   0
+#define DURABLE_ASYNC  1
+#define DURABLE_STRICT 2
+
+int            iDurableMode(int iMode);
+void           vDurableFile(char *szFile);
+void           vDurableWait(void);
+
+/* Thread pool (POSIX threads; see __PTHREADS__ above). vPoolRun calls
+   pfnTask(pv, l) for l=0,1,...,nTasks-1, concurrently if the pool has
+   more than one thread, and returns when all the calls have returned.
+   iPoolThreads sets the number of threads (including the caller) if
+   nThreads > 0, and returns the current number. */
+
+int            iPoolThreads(int nThreads);
+void           vPoolRun(void (*pfnTask)(void *pv, long l), void *pv,
+		 long nTasks);
+#ifdef __PTHREADS__
+int            iThreadCreate(pthread_t *pth, void *(*pfn)(void *pv),
+		 void *pv);
+#endif
 
 #undef  _iSignum
 #define _iSignum  iSignum
@@ -965,7 +1313,10 @@ char *__szULL(char *sz, uint64_t ull);
 
 /* clrscr in Cygwin must be kludged; use the conio3 version instead */
 
-#if defined(__MINGW__) || defined(__LINUX__)
+#if defined(__LINUX__)  /* ANSI, as clear would write it */
+  #undef  clrscr
+  #define clrscr() {fputs("\033[H\033[2J", stdout); fflush(stdout);}
+#elif defined(__MINGW__)
   #undef  clrscr
   #define clrscr() {system("clear");}
 #elif defined(__DMC__)